@@ -11,6 +11,9 @@
 #include <stacsos/kernel/arch/x86/msr.h>
 #include <stacsos/kernel/config.h>
 #include <stacsos/kernel/debug.h>
+#include <stacsos/kernel/lock.h>
+#include <stacsos/kernel/sched/alg/cfs.h>
+#include <stacsos/kernel/sched/alg/class-scheduler.h>
 #include <stacsos/kernel/sched/alg/rr.h>
 #include <stacsos/kernel/sched/alg/scheduling-algorithm.h>
 #include <stacsos/kernel/sched/alg/sfs.h>
@@ -38,28 +41,47 @@ public:
 		, status_(core_status::offline)
 		, irqs_(*this)
 		, sched_alg_(nullptr)
+		, nr_runnable_(0)
+		, next_balance_(0)
+		, current_(nullptr)
+		, need_resched_(false)
 		, clock_(0)
 		, last_clock_(0)
 	{
 		idle_thread_.entity = nullptr;
 		idle_thread_.mcontext = nullptr;
 
-		//*new alg::simple_fair_scheduler()
-
 		const char *sched_alg_name = config::get().get_option("sched");
 		if (!sched_alg_name || *sched_alg_name == 0) {
 			sched_alg_name = "sfs";
 		}
 
-		if (memops::strcmp(sched_alg_name, "sfs") == 0) {
-			sched_alg_ = new alg::simple_fair_scheduler();
-		} else if (memops::strcmp(sched_alg_name, "rr") == 0) {
-			sched_alg_ = new alg::round_robin();
-		} else {
+		alg::scheduling_algorithm *fair_alg = create_fair_algorithm(sched_alg_name);
+		if (!fair_alg && memops::strcmp(sched_alg_name, "rr") == 0) {
+			// Round robin can only be chosen at boot, as it can't hand its run queue over to another
+			// algorithm.
+			fair_alg = new alg::round_robin();
+		}
+
+		if (!fair_alg) {
 			panic("Unsupported scheduling algorithm '%s'", sched_alg_name);
 		}
 
+		// Real-time tasks are handled by the scheduling class layer, which sits on top of the chosen
+		// scheduling algorithm.
+		sched_alg_ = new alg::class_scheduler(fair_alg);
+
 		dprintf("core: using scheduling algorithm: %s\n", sched_alg_->name());
+
+		tickless_ = memops::strcmp(config::get().get_option_or_default("timer", "periodic"), "tickless") == 0;
+
+		// Time slice lengths (in milliseconds) for each scheduling policy.
+		time_slice_ms_[(int)sched_policy::normal] = config::get().get_option_u64_or_default("slice_normal", 10);
+		time_slice_ms_[(int)sched_policy::batch] = config::get().get_option_u64_or_default("slice_batch", 50);
+		time_slice_ms_[(int)sched_policy::interactive] = config::get().get_option_u64_or_default("slice_interactive", 2);
+		time_slice_ms_[(int)sched_policy::rt_fifo] = 0; // FIFO tasks run until they block, or are preempted.
+		time_slice_ms_[(int)sched_policy::rt_rr] = config::get().get_option_u64_or_default("slice_rr", 10);
+		time_slice_ms_[(int)sched_policy::deadline] = 0; // Deadline tasks run until their budget is exhausted.
 	}
 
 	int id() const { return id_; }
@@ -71,8 +93,81 @@ public:
 
 	virtual timer &local_timer() = 0;
 
-	void add_to_runqueue(tcb &tcb) { sched_alg_->add_to_runqueue(tcb); }
-	void remove_from_runqueue(tcb &tcb) { sched_alg_->remove_from_runqueue(tcb); }
+	/**
+	 * @brief Interrupts this core (from another core), so that it reschedules.
+	 */
+	virtual void kick() = 0;
+
+	/**
+	 * @brief Switches from the current task to the next one, directly (i.e. without taking a trap).
+	 * The current task has usually been taken off the run queue, e.g. because it's blocking, and this
+	 * returns when it is resumed.  If it's still runnable, this is a preemption point, and may return
+	 * straight away.
+	 */
+	virtual void switch_to_next() = 0;
+
+	/**
+	 * @brief Called repeatedly by the idle task.  Puts this core to sleep (with interrupts enabled) until there might
+	 * be work for it to do, i.e. until it is kicked, or some other interrupt arrives.
+	 */
+	virtual void idle() = 0;
+
+	/**
+	 * @brief Returns true if something has asked this core to pick a new task, which it hasn't done yet.
+	 */
+	bool resched_pending() const { return need_resched_; }
+
+	/**
+	 * @brief Makes this core pick a new task, as soon as possible.  On the calling core, that happens on
+	 * the way out of the current interrupt or system call.
+	 */
+	void request_resched()
+	{
+		need_resched_ = true;
+
+		if (this != &this_core()) {
+			kick();
+		}
+	}
+
+	/**
+	 * @brief Makes this core forget about a task that has terminated (and is no longer running), so that the task's
+	 * state can be freed.
+	 */
+	virtual void forget_task(const tcb &t) = 0;
+
+	/**
+	 * @brief Checks that this core no longer has the page tables with the given CR3 loaded, e.g. because the idle
+	 * task borrowed them, so that they can be freed.  If it does, the core is asked to let go of them, and this
+	 * returns false, in which case the caller should check again later.
+	 */
+	virtual bool release_address_space(u64 cr3) = 0;
+
+	void add_to_runqueue(tcb &tcb);
+	bool remove_from_runqueue(tcb &tcb);
+
+	unsigned int runqueue_length() const { return nr_runnable_; }
+
+	/**
+	 * @brief Creates a fair scheduling algorithm from its short name (as given in the "sched" option), e.g. "sfs".
+	 * Only algorithms that can be switched to (and away from) at runtime are recognised.
+	 *
+	 * @return alg::scheduling_algorithm* The new algorithm, or nullptr if the name isn't recognised.
+	 */
+	static alg::scheduling_algorithm *create_fair_algorithm(const char *name);
+
+	/**
+	 * @brief Switches this core over to a different fair scheduling algorithm, while it is running.  Every
+	 * queued task in the fair class is moved to the new algorithm, with the run queue locked, so no task is
+	 * ever missing from it.
+	 *
+	 * @return true if the switch happened, or false if the name isn't recognised.
+	 */
+	bool set_fair_algorithm(const char *name);
+
+	const char *sched_alg_name();
+
+	void balance();
 
 	void schedule();
 
@@ -86,15 +181,57 @@ public:
 
 	void update_clock();
 
+	const latency_histogram &wakeup_latency() const { return wakeup_latency_; }
+	spinlock_stats runqueue_lock_stats() const { return runqueue_lock_.stats(); }
+
 private:
 	int id_;
 	core_status status_;
 	irq_manager irqs_;
 
 	tcb idle_thread_;
-	alg::scheduling_algorithm *sched_alg_;
+	alg::class_scheduler *sched_alg_;
+
+	// The run queue may be manipulated by other cores, e.g. when they wake up a task
+	// that lives on this core, and so must be protected.
+	spinlock_irq runqueue_lock_;
+	unsigned int nr_runnable_;
+
+	// The timestamp counter value at which the next load balancing run is due.
+	u64 next_balance_;
+
+	// In tickless mode, the local timer is armed for the next event (i.e. the end of the current
+	// time slice, the next sleeper deadline, or the next load balancing run), rather than ticking
+	// periodically.
+	bool tickless_;
+
+	// The task currently running on this core, and whether it should be preempted at the next
+	// opportunity (even if its time slice hasn't expired).
+	tcb *volatile current_;
+	volatile bool need_resched_;
+
+	u64 time_slice_ms_[(int)sched_policy::nr_policies];
+
+	// The time between tasks on this core becoming runnable, and being dispatched.
+	latency_histogram wakeup_latency_;
 
 	u64 clock_;
 	u64 last_clock_;
+
+	// The time between load balancing runs.
+	static const u64 balance_interval_ms = 100;
+
+	// The frequency of the periodic tick.
+	static const u64 tick_frequency = 100;
+
+	static const u64 no_slice_expiry = ~0ull;
+
+	u64 time_slice(const tcb &t) const;
+	bool may_run_here(const tcb &t) const;
+	void program_timer(u64 slice_expiry);
+	u64 balance_period() const;
+
+	core *find_busiest_core();
+	bool pull_task_from(core &src);
 };
 } // namespace stacsos::kernel::arch
@@ -30,6 +30,11 @@ public:
 	virtual void start(u64 period) = 0;
 	virtual void stop() = 0;
 
+	/**
+	 * @brief Arms the timer to fire once, at the given deadline (in timestamp counter ticks).
+	 */
+	virtual void start_oneshot(u64 deadline) = 0;
+
 private:
 	timer_callback cb_;
 	void *cb_arg_;
@@ -101,20 +101,21 @@ public:
 	static void write(cr4_flags flags) { asm volatile("mov %0, %%cr4" ::"r"((unsigned long)flags)); }
 };
 
+// Set at boot if the processor supports the FSGSBASE instructions (and they have been enabled in CR4),
+// in which case they're used instead of the much slower MSR accesses.  This is also checked on the
+// trap path, in irq-traps.S.
+extern "C" bool x86_fsgsbase_enabled;
+
 class fsbase {
 public:
-#ifdef USE_FSGSBASE
 	static u64 read()
 	{
-		u64 fsbase;
-		asm volatile("rdfsbase %0" : "=r"(fsbase));
-		return fsbase;
-	}
+		if (x86_fsgsbase_enabled) {
+			u64 fsbase;
+			asm volatile("rdfsbase %0" : "=r"(fsbase));
+			return fsbase;
+		}
 
-	static void write(u64 value) { asm volatile("wrfsbase %0" ::"r"(value)); }
-#else
-	static u64 read()
-	{
 		u32 low, high;
 
 		asm volatile("rdmsr" : "=a"(low), "=d"(high) : "c"((u32)0xc0000100u));
@@ -123,28 +124,28 @@ public:
 
 	static void write(u64 value)
 	{
+		if (x86_fsgsbase_enabled) {
+			asm volatile("wrfsbase %0" ::"r"(value));
+			return;
+		}
+
 		u32 low = value & 0xffffffff;
 		u32 high = (value >> 32);
 
 		asm volatile("wrmsr" : : "c"(0xc0000100u), "a"(low), "d"(high));
 	}
-#endif
 };
 
 class gsbase {
 public:
-#ifdef USE_FSGSBASE
 	static u64 read()
 	{
-		u64 gsbase;
-		asm volatile("rdgsbase %0" : "=r"(gsbase));
-		return gsbase;
-	}
+		if (x86_fsgsbase_enabled) {
+			u64 gsbase;
+			asm volatile("rdgsbase %0" : "=r"(gsbase));
+			return gsbase;
+		}
 
-	static void write(u64 value) { asm volatile("wrgsbase %0" ::"r"(value)); }
-#else
-	static u64 read()
-	{
 		u32 low, high;
 
 		asm volatile("rdmsr" : "=a"(low), "=d"(high) : "c"((u32)0xc0000101u));
@@ -153,11 +154,35 @@ public:
 
 	static void write(u64 value)
 	{
+		if (x86_fsgsbase_enabled) {
+			asm volatile("wrgsbase %0" ::"r"(value));
+			return;
+		}
+
 		u32 low = value & 0xffffffff;
 		u32 high = (value >> 32);
 
 		asm volatile("wrmsr" : : "c"(0xc0000101u), "a"(low), "d"(high));
 	}
-#endif
+};
+
+/**
+ * The GS base of user mode, while executing in the kernel.  This is held in the kernel GS base MSR
+ * until it's swapped back in by SWAPGS on the way out of the kernel.  Interrupts must be disabled.
+ */
+class user_gsbase {
+public:
+	static void write(u64 value)
+	{
+		if (x86_fsgsbase_enabled) {
+			asm volatile("swapgs; wrgsbase %0; swapgs" ::"r"(value));
+			return;
+		}
+
+		u32 low = value & 0xffffffff;
+		u32 high = (value >> 32);
+
+		asm volatile("wrmsr" : : "c"(0xc0000102u), "a"(low), "d"(high));
+	}
 };
 } // namespace stacsos::kernel::arch::x86
@@ -328,6 +328,8 @@ public:
 	bool register_interrupt_gate(int index, uintptr_t addr, u16 seg, descriptor_privilege_level dpl);
 	bool register_trap_gate(int index, uintptr_t addr, u16 seg, descriptor_privilege_level dpl);
 
+	void set_interrupt_stack(int index, u8 ist);
+
 	void *ptr() const { return (void *)&idt_[0]; }
 
 private:
@@ -349,6 +351,7 @@ public:
 	void reload(u16 sel);
 
 	void set_kernel_stack(uintptr_t stack);
+	void set_interrupt_stack(int ist, uintptr_t stack);
 
 	void *ptr() const { return (void *)&tss_[0]; }
 
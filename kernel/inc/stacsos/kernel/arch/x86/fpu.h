@@ -0,0 +1,35 @@
+/* SPDX-License-Identifier: MIT */
+
+/* StACSOS - Kernel
+ *
+ * Copyright (c) University of St Andrews 2024
+ * Tom Spink <tcs6@st-andrews.ac.uk>
+ */
+#pragma once
+
+namespace stacsos::kernel::arch::x86 {
+
+/**
+ * Saves and restores the extended (x87, SSE and AVX) register state of threads.  The kernel itself
+ * never touches these registers, so the state only needs to be switched for user threads that use
+ * them.  This is done lazily: CR0.TS is set when switching to a thread whose state isn't loaded, and
+ * the resulting device-not-available fault loads it (see x86_core::handle_fpu_trap).
+ */
+class fpu {
+public:
+	static void init();
+
+	static void *alloc_state();
+	static void free_state(void *state);
+	static void save(void *state);
+	static void restore(void *state);
+
+	static void set_task_switched();
+	static void clear_task_switched() { asm volatile("clts"); }
+	static bool task_switched();
+
+private:
+	static bool use_xsave_, use_xsaveopt_;
+	static u32 state_size_;
+};
+} // namespace stacsos::kernel::arch::x86
@@ -34,6 +34,8 @@ public:
 
 	virtual void stop() { lapic_.mask_interrupts(x2apic_lvts::timer); }
 
+	virtual void start_oneshot(u64 deadline) override;
+
 private:
 	static void timer_irq_handler(u8 irq, void *context, void *arg);
 	x2apic &lapic_;
@@ -14,19 +14,29 @@
 #include <stacsos/kernel/arch/x86/tsc.h>
 #include <stacsos/kernel/arch/x86/x2apic-timer.h>
 #include <stacsos/kernel/arch/x86/x2apic.h>
+#include <stacsos/kernel/mem/address-space.h>
 
 namespace stacsos::kernel::arch::x86 {
 class x86_core : public core {
 public:
-	explicit x86_core(int id)
+	x86_core(int id, u32 apic_id)
 		: core(id)
+		, apic_id_(apic_id)
 		, gdt_(*this)
 		, idt_(*this)
 		, tss_(*this)
 		, irqs_(idt_)
 		, lapic_(*this)
 		, timer_(lapic_)
+		, fpu_owner_(nullptr)
+		, kernel_cr3_(0)
+		, active_cr3_(0)
+		, pcid_enabled_(false)
+		, release_borrowed_cr3_(false)
+		, idle_mode_(idle_mode::poll)
+		, idle_polling_(false)
 	{
+		memops::bzero(asid_generations_, sizeof(asid_generations_));
 	}
 
 	static int this_core_id() { return core::this_core_id(); }
@@ -34,8 +44,14 @@ public:
 
 	virtual void init() override;
 	virtual bool remote_run() override;
+	__noreturn void complete_remote_init();
 
 	virtual timer &local_timer() override { return timer_; }
+	virtual void kick() override;
+	virtual void switch_to_next() override;
+	virtual void idle() override;
+	virtual void forget_task(const tcb &t) override;
+	virtual bool release_address_space(u64 cr3) override;
 
 	tsc &local_tsc() { return tsc_; }
 
@@ -55,16 +71,20 @@ public:
 	void dump_regs();
 
 private:
+	// The IRQ used to ask another core to reschedule.
+	static const u8 reschedule_irq = 0xfe;
+
+	// The interrupt stack table entry used for double faults, which must not run on the (possibly overflowed)
+	// kernel stack.
+	static const u8 double_fault_ist = 1;
+
+	u32 apic_id_;
+
 	global_descriptor_table<16> gdt_;
 	interrupt_descriptor_table<256> idt_;
 	task_state_segment tss_;
 
-	struct {
-		u64 task_ptr;
-		u64 context_ptr;
-		u64 cr3;
-		u64 kernel_stack;
-	} temporary_tcb;
+	tcb temporary_tcb;
 
 	irq::irq_manager<256> irqs_;
 
@@ -72,9 +92,44 @@ private:
 	x2apic_timer timer_;
 	tsc tsc_;
 
+	// The task whose extended register state was most recently loaded on this core.
+	tcb *fpu_owner_;
+
+	// The CR3 of the kernel's root address space, the CR3 currently loaded on this core (without the no-flush bit),
+	// and whether or not TLB entries are being tagged with process-context identifiers.
+	u64 kernel_cr3_;
+	u64 active_cr3_;
+	bool pcid_enabled_;
+
+	// Set when the page tables that the idle task is borrowing are about to be freed, so that the kernel's own ones are
+	// loaded instead.
+	volatile bool release_borrowed_cr3_;
+
+	// The generation of each address space identifier that this core last activated (see address_space::asid_generation).
+	u32 asid_generations_[mem::address_space::max_asid + 1];
+
+	void switch_address_space(const tcb *next);
+
+	// How this core waits for work when it has nothing to run.  In mwait mode, the idle task monitors idle_polling_,
+	// and a core that wants to kick this one can simply clear it, rather than sending an IPI.
+	enum class idle_mode { poll, hlt, mwait };
+
+	idle_mode idle_mode_;
+	volatile bool idle_polling_;
+
+	void select_idle_mode();
+
 	static void exception_handler(u8 irq, void *context, void *arg)
 	{
 		switch (irq) {
+		case 0x07:
+			((x86_core *)arg)->handle_fpu_trap();
+			break;
+
+		case 0x08:
+			((x86_core *)arg)->handle_double_fault((machine_context *)context);
+			break;
+
 		case 0x0d:
 			((x86_core *)arg)->handle_gpf((machine_context *)context);
 			break;
@@ -90,10 +145,12 @@ private:
 	}
 
 	void populate_dt();
-	// pfn_t prepare_mpstartup_code();
-	// void complete_remote_init();
+	u8 prepare_mpstartup_code();
 
+	void switch_fpu(tcb *prev, const tcb *next);
+	void handle_fpu_trap();
 	void handle_gpf(machine_context *mc);
+	void handle_double_fault(machine_context *mc);
 	void handle_page_fault(machine_context *mc);
 };
 } // namespace stacsos::kernel::arch::x86
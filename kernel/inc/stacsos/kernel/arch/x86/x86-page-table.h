@@ -45,6 +45,15 @@ public:
 	 */
 	x86_page_table *create_linked_copy(mem::page_table_allocator &pta);
 
+	/**
+	 * @brief Frees a page table that was created with create_linked_copy, along with the intermediate tables that
+	 * were allocated for the lower (user) half of the address space.  The upper half is shared with the original
+	 * page table, and so is left alone, as are the pages that were mapped.
+	 *
+	 * @param pta The allocator that was used for allocating the page tables.
+	 */
+	void destroy_linked_copy(mem::page_table_allocator &pta);
+
 	/**
 	 * @brief Retrieves a pointer to the current X86 page table.
 	 *
@@ -77,6 +86,15 @@ public:
 		asm volatile("mov %0, %%cr3" ::"r"(cr3val) : "memory");
 	}
 
+	/**
+	 * @brief Makes sure that the top-level (i.e. pml4) entry covering a kernel virtual address is present, so that
+	 * mappings made underneath it later on are shared with page tables that have already been linked from this one.
+	 *
+	 * @param pta The allocator to use for allocating page tables.
+	 * @param virtual_address The virtual address that will be mapped later on.
+	 */
+	void prepare_top_level(mem::page_table_allocator &pta, u64 virtual_address);
+
 	/**
 	 * @brief Adds a new mapping into the page table, mapping a virtual address to a physical address, with the requested flags.
 	 *
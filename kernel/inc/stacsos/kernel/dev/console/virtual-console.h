@@ -9,8 +9,8 @@
 
 #include <stacsos/kernel/dev/device.h>
 #include <stacsos/kernel/dev/input/keys.h>
-#include <stacsos/kernel/sched/event.h>
 #include <stacsos/kernel/sched/thread.h>
+#include <stacsos/kernel/sched/wait-queue.h>
 #include <stacsos/memops.h>
 
 namespace stacsos::kernel::dev::console {
@@ -88,6 +88,7 @@ public:
 
 	void write_char(unsigned char ch, u8 attr);
 	u8 read_char();
+	size_t try_read(void *buffer, size_t length);
 
 	void clear();
 
@@ -101,9 +102,10 @@ private:
 	keyboard_modifiers current_mod_mask_;
 	bool active_;
 
+	// The typed characters that haven't been read yet, which are protected by the read waiters' lock.
 	u8 read_buffer_[256];
 	u8 read_buffer_head_, read_buffer_tail_;
-	sched::auto_reset_event read_buffer_event_;
+	sched::wait_queue read_waiters_;
 
 	static void cursor_flasher_thread_proc(void *arg);
 	shared_ptr<sched::thread> cursor_flasher_;
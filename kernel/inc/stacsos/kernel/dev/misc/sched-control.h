@@ -0,0 +1,33 @@
+/* SPDX-License-Identifier: MIT */
+
+/* StACSOS - Kernel
+ *
+ * Copyright (c) University of St Andrews 2024
+ * Tom Spink <tcs6@st-andrews.ac.uk>
+ */
+#pragma once
+
+#include <stacsos/kernel/dev/device.h>
+
+namespace stacsos::kernel::dev::misc {
+
+/**
+ * Allows the fair scheduling algorithm of each core to be changed while the system is running.  Reading
+ * the device lists the algorithm in use on every core.  Writing an algorithm name (as accepted by the
+ * "sched" option, e.g. "cfs") switches every core over to it, and writing a core number followed by an
+ * algorithm name (e.g. "1 sfs") switches just that core.
+ */
+class sched_control : public device {
+public:
+	static device_class sched_control_device_class;
+
+	sched_control(bus &owner)
+		: device(sched_control_device_class, owner)
+	{
+	}
+
+	virtual void configure() override { }
+
+	virtual shared_ptr<fs::file> open_as_file() override;
+};
+} // namespace stacsos::kernel::dev::misc
@@ -0,0 +1,31 @@
+/* SPDX-License-Identifier: MIT */
+
+/* StACSOS - Kernel
+ *
+ * Copyright (c) University of St Andrews 2024
+ * Tom Spink <tcs6@st-andrews.ac.uk>
+ */
+#pragma once
+
+#include <stacsos/kernel/dev/device.h>
+
+namespace stacsos::kernel::dev::misc {
+
+/**
+ * Exposes scheduler statistics to userspace.  When opened, the device takes a snapshot of the
+ * wakeup-to-run latency histograms of every core and every thread, and returns them as text.
+ */
+class sched_stats : public device {
+public:
+	static device_class sched_stats_device_class;
+
+	sched_stats(bus &owner)
+		: device(sched_stats_device_class, owner)
+	{
+	}
+
+	virtual void configure() override { }
+
+	virtual shared_ptr<fs::file> open_as_file() override;
+};
+} // namespace stacsos::kernel::dev::misc
@@ -9,6 +9,7 @@
 
 #include <stacsos/kernel/dev/storage/ahci-structures.h>
 #include <stacsos/kernel/dev/storage/block-device.h>
+#include <stacsos/kernel/sched/mutex.h>
 
 namespace stacsos::kernel::dev::storage {
 class ahci_storage_device : public block_device {
@@ -35,6 +36,10 @@ private:
 	volatile hba_port *port_;
 	u64 nr_blocks_;
 
+	// Serialises the selection, set-up and completion of command slots.  Commands are polled until they
+	// complete, which can take a while, so other submitters sleep rather than spin.
+	sched::mutex command_lock_;
+
 	volatile hba_cmd_header *get_free_cmd_slot(int &slot_index);
 	void identify();
 	void detect_partitions();
@@ -10,6 +10,7 @@
 #include <stacsos/kernel/fs/file.h>
 #include <stacsos/kernel/fs/filesystem.h>
 #include <stacsos/kernel/fs/fs-node.h>
+#include <stacsos/kernel/sched/mutex.h>
 #include <stacsos/list.h>
 #include <stacsos/memory.h>
 
@@ -80,6 +81,10 @@ private:
 	u64 data_size_;
 	bool loaded_;
 	list<fat_node *> children_;
+
+	// Protects the list of children.  Loading the directory holds this as a writer, so that concurrent
+	// lookups sleep while the directory is read from disk, rather than loading it again.
+	sched::rw_semaphore children_lock_;
 };
 
 class fat_filesystem : public physical_filesystem {
@@ -22,6 +22,7 @@ public:
 	virtual u64 ioctl(u64 cmd, void *buffer, size_t length) { return 0; }
 
 	virtual size_t pread(void *buffer, size_t offset, size_t length) = 0;
+
 	virtual size_t pwrite(const void *buffer, size_t offset, size_t length) = 0;
 
 	virtual size_t read(void *buffer, size_t length)
@@ -37,6 +38,16 @@ public:
 		return result;
 	}
 
+	/**
+	 * @brief Reads up to length bytes, but only those that are available without blocking.  Returns false if
+	 * nothing could be read without blocking.  Files that never block just read.
+	 */
+	virtual bool try_read(void *buffer, size_t length, size_t &bytes_read)
+	{
+		bytes_read = read(buffer, length);
+		return true;
+	}
+
 	virtual size_t write(const void *buffer, size_t length)
 	{
 		u64 write_length = length;
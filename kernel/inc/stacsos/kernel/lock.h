@@ -9,23 +9,72 @@
 
 #include <stacsos/helpers.h>
 
-typedef unsigned int spinlock_var_t;
+#if defined(SPINLOCK_MCS)
+// For the MCS lock, the lock is itself a queue node (see lock.cpp).
+struct spinlock_mcs_node {
+	spinlock_mcs_node *tail;
+	spinlock_mcs_node *next;
+};
+#endif
+
+struct spinlock_var_t {
+#if defined(SPINLOCK_MCS)
+	spinlock_mcs_node mcs;
+#elif defined(SPINLOCK_TICKET)
+	union {
+		u32 value;
+		struct {
+			u16 owner; // The ticket currently being served.
+			u16 next; // The next ticket to be handed out.
+		};
+	};
+#else
+	u32 value;
+#endif
+
+#if defined(SPINLOCK_STATS)
+	// These are only updated by the lock holder, so they don't need to be atomic.
+	u64 acquisitions;
+	u64 contentions;
+#endif
+};
+
 extern "C" void spinlock_acquire(spinlock_var_t *lv);
 extern "C" void spinlock_release(spinlock_var_t *lv);
 extern "C" void spinlock_irq_acquire(spinlock_var_t *lv, u64 *flags);
 extern "C" void spinlock_irq_release(spinlock_var_t *lv, u64 flags);
 
 namespace stacsos::kernel {
+/**
+ * Reports how often a spinlock has been acquired, and how many of those acquisitions had to wait.  These
+ * are always zero if SPINLOCK_STATS isn't defined.
+ */
+struct spinlock_stats {
+	u64 acquisitions;
+	u64 contentions;
+};
+
+static inline spinlock_stats get_spinlock_stats(const spinlock_var_t &lv)
+{
+#if defined(SPINLOCK_STATS)
+	return spinlock_stats { lv.acquisitions, lv.contentions };
+#else
+	return spinlock_stats { 0, 0 };
+#endif
+}
+
 class spinlock {
 public:
 	spinlock()
-		: spin_lock_var_(0)
+		: spin_lock_var_ {}
 	{
 	}
 
 	void lock() { ::spinlock_acquire(&spin_lock_var_); }
 	void unlock() { ::spinlock_release(&spin_lock_var_); }
 
+	spinlock_stats stats() const { return get_spinlock_stats(spin_lock_var_); }
+
 private:
 	DELETE_DEFAULT_COPY_AND_MOVE(spinlock);
 
@@ -35,13 +84,15 @@ private:
 class spinlock_irq {
 public:
 	spinlock_irq()
-		: spin_lock_var_(0)
+		: spin_lock_var_ {}
 	{
 	}
 
 	void lock(u64 *flags) { ::spinlock_irq_acquire(&spin_lock_var_, flags); }
 	void unlock(u64 flags) { ::spinlock_irq_release(&spin_lock_var_, flags); }
 
+	spinlock_stats stats() const { return get_spinlock_stats(spin_lock_var_); }
+
 private:
 	DELETE_DEFAULT_COPY_AND_MOVE(spinlock_irq);
 
@@ -7,6 +7,7 @@
  */
 #pragma once
 
+#include <stacsos/kernel/lock.h>
 #include <stacsos/kernel/mem/address-space-region.h>
 #include <stacsos/kernel/mem/page-table.h>
 #include <stacsos/list.h>
@@ -23,19 +24,36 @@ public:
 		: pta_(pta)
 		, pt_(page_table::create_empty(pta))
 		, next_alloc_rgn_(alloc_rgn_start)
+		, asid_(0)
 	{
 	}
 
-	~address_space() { panic("free addrspace"); }
+	~address_space();
 
 	page_table &pgtable() const { return *pt_; }
 
+	/**
+	 * @brief Returns the identifier used to tag this address space's TLB entries.  Zero means the address space is
+	 * untagged, and its translations must be flushed whenever it is activated.
+	 */
+	u16 asid() const { return asid_; }
+
+	static const u16 max_asid = 0xfff;
+
+	/**
+	 * @brief Returns how many times the given identifier has been released.  Translations tagged with an identifier
+	 * may outlive its address space, so a core must flush them when it sees that the generation has moved on.
+	 */
+	static u32 asid_generation(u16 asid) { return __atomic_load_n(&asid_generations_[asid], __ATOMIC_RELAXED); }
+
 	address_space_region *alloc_region(u64 size, region_flags flags, bool allocate);
 	address_space_region *add_region(u64 base, u64 size, region_flags flags, bool allocate);
 	void remove_region(u64 base, u64 size, region_flags flags);
 
 	address_space_region *get_region_from_address(u64 address)
 	{
+		unique_irq_lock l(lock_);
+
 		for (address_space_region *rgn : regions_) {
 			if (address >= rgn->base && address < (rgn->base + rgn->size)) {
 				return rgn;
@@ -48,17 +66,26 @@ public:
 	address_space *create_linked(u64 alloc_rgn_start);
 
 private:
-	address_space(page_table_allocator &pta, page_table *pt, u64 alloc_rgn_start)
+	address_space(page_table_allocator &pta, page_table *pt, u64 alloc_rgn_start, u16 asid)
 		: pta_(pta)
 		, pt_(pt)
 		, next_alloc_rgn_(alloc_rgn_start)
+		, asid_(asid)
 	{
 	}
 
 	page_table_allocator &pta_;
 	page_table *pt_;
 
+	// Protects the region list, the region allocation cursor, and changes to the page tables, as the threads of a
+	// process may change its address space at the same time.
+	spinlock_irq lock_;
 	list<address_space_region *> regions_;
 	u64 next_alloc_rgn_;
+	u16 asid_;
+	static u32 asid_generations_[max_asid + 1];
+
+	static u16 allocate_asid();
+	static void free_asid(u16 asid);
 };
 } // namespace stacsos::kernel::mem
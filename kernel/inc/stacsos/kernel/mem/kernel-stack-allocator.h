@@ -0,0 +1,66 @@
+/* SPDX-License-Identifier: MIT */
+
+/* StACSOS - Kernel
+ *
+ * Copyright (c) University of St Andrews 2024
+ * Tom Spink <tcs6@st-andrews.ac.uk>
+ */
+#pragma once
+
+#include <stacsos/kernel/arch/core-manager.h>
+#include <stacsos/kernel/lock.h>
+
+namespace stacsos::kernel::mem {
+class page_table_allocator;
+
+/**
+ * Allocates kernel stacks.  Each stack lives in its own slot in a dedicated area of the kernel's address space, and
+ * is made up of individually allocated pages, with an unmapped guard page underneath it, so that overflowing it
+ * faults, rather than corrupting whatever is below.  Stacks are never unmapped: freed stacks are kept in a small
+ * per-core cache (and then a global free list), ready to be handed out again.
+ */
+class kernel_stack_allocator {
+public:
+	kernel_stack_allocator();
+
+	void init();
+
+	void *allocate();
+	void free(void *stack);
+
+	/**
+	 * @brief Returns the size of every kernel stack, i.e. the distance between the lowest address returned by
+	 * allocate() and the initial stack pointer.
+	 */
+	size_t stack_size() const { return stack_pages_ << PAGE_BITS; }
+
+	bool is_guard_page(u64 address) const;
+
+private:
+	static const unsigned int cache_size = 8;
+
+	struct core_cache {
+		core_cache()
+			: count(0)
+		{
+		}
+
+		spinlock_irq lock;
+		void *stacks[cache_size];
+		unsigned int count;
+	};
+
+	u64 area_base_, area_size_;
+	u64 stack_pages_;
+
+	core_cache caches_[arch::core_manager::max_cores];
+
+	// Protects the free list, and the allocation of new slots.  A free stack holds a pointer to the next one.
+	spinlock_irq lock_;
+	u64 next_slot_;
+	void *free_stacks_;
+
+	u64 slot_size() const { return (stack_pages_ + 1) << PAGE_BITS; }
+	void *map_slot(u64 slot);
+};
+} // namespace stacsos::kernel::mem
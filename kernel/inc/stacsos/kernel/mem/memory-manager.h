@@ -8,6 +8,7 @@
 #pragma once
 
 #include <stacsos/kernel/mem/address-space.h>
+#include <stacsos/kernel/mem/kernel-stack-allocator.h>
 #include <stacsos/kernel/mem/object-allocator.h>
 #include <stacsos/kernel/mem/page-allocator.h>
 #include <stacsos/kernel/mem/page-table-allocator.h>
@@ -36,6 +37,9 @@ public:
 	object_allocator &objalloc() { return objalloc_; }
 	const object_allocator &objalloc() const { return objalloc_; }
 
+	kernel_stack_allocator &kstackalloc() { return kstackalloc_; }
+	const kernel_stack_allocator &kstackalloc() const { return kstackalloc_; }
+
 	address_space &root_address_space() const { return *root_address_space_; }
 
 	bool try_handle_page_fault(u64 faulting_address);
@@ -49,6 +53,7 @@ private:
 	page_allocator *pgalloc_;
 	page_table_allocator ptalloc_;
 	object_allocator objalloc_;
+	kernel_stack_allocator kstackalloc_;
 
 	address_space *root_address_space_;
 };
@@ -7,6 +7,7 @@
  */
 #pragma once
 
+#include <stacsos/kernel/lock.h>
 #include <stacsos/kernel/mem/page-allocator.h>
 
 namespace stacsos::kernel::mem {
@@ -28,5 +29,6 @@ public:
 
 private:
 	page *free_list_;
+	spinlock_irq lock_;
 };
 } // namespace stacsos::kernel::mem
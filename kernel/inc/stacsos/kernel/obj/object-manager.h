@@ -8,6 +8,7 @@
 #pragma once
 
 #include <stacsos/atomic.h>
+#include <stacsos/kernel/lock.h>
 #include <stacsos/kernel/obj/object.h>
 #include <stacsos/map.h>
 
@@ -28,6 +29,8 @@ private:
 public:
 	shared_ptr<object> get_object(sched::process &owner, u64 id)
 	{
+		unique_irq_lock l(lock_);
+
 		map<u64, shared_ptr<object>> *process_object_map;
 		if (!objects_.try_get_value(&owner, process_object_map)) {
 			return nullptr;
@@ -41,7 +44,8 @@ public:
 		return optr;
 	}
 
-	void free_object(sched::process &owner, u64 id) { }
+	void free_object(sched::process &owner, u64 id);
+	void free_process_objects(sched::process &owner);
 
 	shared_ptr<object> create_file_object(sched::process &owner, shared_ptr<fs::file> file)
 	{
@@ -62,18 +66,24 @@ private:
 	atomic_u64 next_id_;
 	map<sched::process *, map<u64, shared_ptr<object>> *> objects_;
 
+	// Protects the object maps.  Objects are only ever destroyed once they have been taken out of the maps and the
+	// lock has been dropped, as destroying them may block (e.g. when closing a file).
+	spinlock_irq lock_;
+
 	u64 allocate_id(sched::process &owner) { return next_id_++; }
 
 	shared_ptr<object> register_object(sched::process &owner, object *o)
 	{
+		auto object_ptr = shared_ptr(o);
+
+		unique_irq_lock l(lock_);
+
 		map<u64, shared_ptr<object>> *process_object_map;
 		if (!objects_.try_get_value(&owner, process_object_map)) {
 			process_object_map = new map<u64, shared_ptr<object>>();
 			objects_.add(&owner, process_object_map);
 		}
 
-		auto object_ptr = shared_ptr(o);
-
 		process_object_map->add(o->id(), object_ptr);
 		return object_ptr;
 	}
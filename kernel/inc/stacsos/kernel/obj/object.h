@@ -13,7 +13,9 @@
 #include <stacsos/memory.h>
 
 namespace stacsos::kernel::obj {
-enum class operation_result_code : u64 { ok = 1, not_found = 2, not_supported = 3 };
+// These values must match syscall_result_code, as operation results are passed straight back to
+// user space.
+enum class operation_result_code : u64 { ok = 0, not_found = 1, not_supported = 2, invalid_argument = 4, over_subscribed = 5, would_block = 6 };
 
 struct operation_result {
 	operation_result_code code;
@@ -21,6 +23,7 @@ struct operation_result {
 
 	static operation_result ok(u64 data = 0) { return operation_result { operation_result_code::ok, data }; }
 	static operation_result not_supported() { return operation_result { operation_result_code::not_supported, 0 }; }
+	static operation_result would_block() { return operation_result { operation_result_code::would_block, 0 }; }
 };
 
 class object {
@@ -31,11 +34,15 @@ public:
 
 	virtual operation_result read(void *buffer, size_t length) { return operation_result::not_supported(); }
 	virtual operation_result pread(void *buffer, size_t length, size_t offset) { return operation_result::not_supported(); }
+	virtual operation_result try_read(void *buffer, size_t length) { return operation_result::not_supported(); }
 	virtual operation_result write(const void *buffer, size_t length) { return operation_result::not_supported(); }
 	virtual operation_result pwrite(const void *buffer, size_t length, size_t offset) { return operation_result::not_supported(); }
 	virtual operation_result ioctl(u64 cmd, void *buffer, size_t length) { return operation_result::not_supported(); }
 	virtual operation_result wait_for_status_change() { return operation_result::not_supported(); }
 	virtual operation_result join() { return operation_result::not_supported(); }
+	virtual operation_result set_sched_policy(u64 policy, u64 priority) { return operation_result::not_supported(); }
+	virtual operation_result set_deadline(u64 runtime_us, u64 deadline_us, u64 period_us) { return operation_result::not_supported(); }
+	virtual operation_result set_affinity(u64 mask) { return operation_result::not_supported(); }
 
 protected:
 	object(u64 id)
@@ -57,6 +64,20 @@ public:
 
 	virtual operation_result read(void *buffer, size_t length) { return operation_result::ok(file_->read(buffer, length)); }
 	virtual operation_result pread(void *buffer, size_t length, size_t offset) { return operation_result::ok(file_->pread(buffer, offset, length)); }
+
+	/**
+	 * Reads as much as is available, up to length bytes, without blocking.  If nothing is available, the
+	 * read fails with would_block.
+	 */
+	virtual operation_result try_read(void *buffer, size_t length)
+	{
+		size_t bytes_read;
+		if (!file_->try_read(buffer, length, bytes_read)) {
+			return operation_result::would_block();
+		}
+
+		return operation_result::ok(bytes_read);
+	}
 	virtual operation_result write(const void *buffer, size_t length) { return operation_result::ok(file_->write(buffer, length)); }
 	virtual operation_result pwrite(const void *buffer, size_t length, size_t offset) { return operation_result::ok(file_->pwrite(buffer, offset, length)); }
 	virtual operation_result ioctl(u64 cmd, void *buffer, size_t length) { return operation_result::ok(file_->ioctl(cmd, buffer, length)); }
@@ -75,12 +96,7 @@ public:
 
 	virtual operation_result wait_for_status_change() override
 	{
-		sched::process_state initial = proc_->state();
-
-		while (proc_->state() == initial) {
-			proc_->state_changed_event().wait();
-		}
-
+		proc_->wait_for_state_change(proc_->state());
 		return operation_result::ok(0);
 	}
 
@@ -98,8 +114,35 @@ public:
 
 	virtual operation_result join() override
 	{
-		while (thread_->state() != sched::thread_states::terminated) {
-			thread_->state_changed_event().wait();
+		thread_->join();
+		return operation_result::ok(0);
+	}
+
+	virtual operation_result set_sched_policy(u64 policy, u64 priority) override
+	{
+		if (!thread_->set_sched_policy((sched_policy)policy, (u32)priority)) {
+			return operation_result { operation_result_code::invalid_argument, 0 };
+		}
+
+		return operation_result::ok(0);
+	}
+
+	virtual operation_result set_deadline(u64 runtime_us, u64 deadline_us, u64 period_us) override
+	{
+		switch (thread_->set_deadline(runtime_us, deadline_us, period_us)) {
+		case sched::deadline_result::ok:
+			return operation_result::ok(0);
+		case sched::deadline_result::over_subscribed:
+			return operation_result { operation_result_code::over_subscribed, 0 };
+		default:
+			return operation_result { operation_result_code::invalid_argument, 0 };
+		}
+	}
+
+	virtual operation_result set_affinity(u64 mask) override
+	{
+		if (!thread_->set_affinity(mask)) {
+			return operation_result { operation_result_code::invalid_argument, 0 };
 		}
 
 		return operation_result::ok(0);
@@ -0,0 +1,61 @@
+/* SPDX-License-Identifier: MIT */
+
+/* StACSOS - Kernel
+ *
+ * Copyright (c) University of St Andrews 2024
+ * Tom Spink <tcs6@st-andrews.ac.uk>
+ */
+#pragma once
+
+#include <stacsos/kernel/sched/alg/scheduling-algorithm.h>
+#include <stacsos/kernel/sched/schedulable-entity.h>
+
+namespace stacsos::kernel::sched::alg {
+
+/**
+ * A fair scheduler that always runs the task with the smallest weighted virtual runtime.  Runnable
+ * tasks are kept in a binary min-heap, which is indexed from the TCB, so insertion and removal are
+ * O(log n), and picking the next task is O(1).
+ */
+class completely_fair_scheduler : public scheduling_algorithm {
+public:
+	// The weight of a task that hasn't been given one.
+	static const u32 default_weight = 1024;
+
+	completely_fair_scheduler()
+		: heap_(nullptr)
+		, count_(0)
+		, capacity_(0)
+		, min_vruntime_(0)
+	{
+	}
+
+	virtual ~completely_fair_scheduler() { delete[] heap_; }
+
+	virtual void add_to_runqueue(tcb &tcb) override;
+	virtual void remove_from_runqueue(tcb &tcb) override;
+	virtual tcb *select_next_task(tcb *current) override;
+	virtual tcb *steal_task(int core_id) override;
+	virtual tcb *drain_task() override { return count_ ? heap_[--count_] : nullptr; }
+	virtual const char *name() const { return "completely fair"; }
+
+private:
+	tcb **heap_;
+	u32 count_, capacity_;
+	u64 min_vruntime_;
+
+	bool contains(const tcb *t) const { return t->rq_index < count_ && heap_[t->rq_index] == t; }
+
+	void charge(tcb &t);
+	void remove_at(u32 index);
+
+	void place(u32 index, tcb *t)
+	{
+		heap_[index] = t;
+		t->rq_index = index;
+	}
+
+	void sift_up(u32 index);
+	void sift_down(u32 index);
+};
+} // namespace stacsos::kernel::sched::alg
@@ -0,0 +1,64 @@
+/* SPDX-License-Identifier: MIT */
+
+/* StACSOS - Kernel
+ *
+ * Copyright (c) University of St Andrews 2024
+ * Tom Spink <tcs6@st-andrews.ac.uk>
+ */
+#pragma once
+
+#include <stacsos/kernel/sched/alg/edf.h>
+#include <stacsos/kernel/sched/alg/scheduling-algorithm.h>
+#include <stacsos/kernel/sched/schedulable-entity.h>
+
+namespace stacsos::kernel::sched::alg {
+
+/**
+ * Layers real-time scheduling classes on top of a fair scheduling algorithm.  Tasks with a real-time
+ * policy (FIFO or round-robin) are kept in one intrusive queue per static priority, with a bitmap of
+ * non-empty queues, so that finding the highest priority task is O(1).  Real-time tasks always run in
+ * preference to, and preempt, tasks in the fair class, which are handed to the underlying algorithm.
+ * Deadline tasks are scheduled by an EDF algorithm, and run in preference to everything else.
+ */
+class class_scheduler : public scheduling_algorithm {
+public:
+	explicit class_scheduler(scheduling_algorithm *fair)
+		: fair_(fair)
+		, rt_bitmap_(0)
+	{
+		for (u32 i = 0; i <= max_rt_priority; i++) {
+			rt_heads_[i] = nullptr;
+			rt_tails_[i] = nullptr;
+		}
+	}
+
+	virtual void add_to_runqueue(tcb &tcb) override;
+	virtual void remove_from_runqueue(tcb &tcb) override;
+	virtual tcb *select_next_task(tcb *current) override;
+	virtual tcb *steal_task(int core_id) override;
+	virtual bool should_preempt(const tcb &current, const tcb &woken) const override;
+	virtual u64 next_event() const override { return deadline_.next_event(); }
+	virtual const char *name() const { return fair_->name(); }
+
+	/**
+	 * @brief Moves every task in the fair class over to a new fair scheduling algorithm, which replaces the
+	 * current one.  Real-time and deadline tasks are unaffected.
+	 *
+	 * @return scheduling_algorithm* The old fair scheduling algorithm, which is now empty, and can be deleted.
+	 */
+	scheduling_algorithm *replace_fair(scheduling_algorithm *fair);
+
+private:
+	scheduling_algorithm *fair_;
+	earliest_deadline_first deadline_;
+
+	u64 rt_bitmap_;
+	tcb *rt_heads_[max_rt_priority + 1];
+	tcb *rt_tails_[max_rt_priority + 1];
+
+	bool rt_contains(const tcb &t) const { return t.rq_prev != nullptr || rt_heads_[t.rt_priority] == &t; }
+
+	void rt_enqueue(tcb &t);
+	void rt_dequeue(tcb &t);
+};
+} // namespace stacsos::kernel::sched::alg
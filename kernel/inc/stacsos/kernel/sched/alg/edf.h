@@ -0,0 +1,51 @@
+/* SPDX-License-Identifier: MIT */
+
+/* StACSOS - Kernel
+ *
+ * Copyright (c) University of St Andrews 2024
+ * Tom Spink <tcs6@st-andrews.ac.uk>
+ */
+#pragma once
+
+#include <stacsos/kernel/sched/alg/scheduling-algorithm.h>
+#include <stacsos/kernel/sched/schedulable-entity.h>
+
+namespace stacsos::kernel::sched::alg {
+
+/**
+ * An earliest-deadline-first scheduler for periodic tasks.  Each task has a runtime budget that it may
+ * consume in every period, and always runs before its absolute deadline.  Runnable tasks are kept in a
+ * list sorted by absolute deadline.  A task that exhausts its budget is throttled (i.e. moved to a
+ * second list, sorted by the start of its next period) until its budget is replenished, so that an
+ * overrunning task can't steal time that has been reserved for other tasks.
+ */
+class earliest_deadline_first : public scheduling_algorithm {
+public:
+	earliest_deadline_first()
+		: ready_head_(nullptr)
+		, throttled_head_(nullptr)
+	{
+	}
+
+	virtual void add_to_runqueue(tcb &tcb) override;
+	virtual void remove_from_runqueue(tcb &tcb) override;
+	virtual tcb *select_next_task(tcb *current) override;
+	virtual bool should_preempt(const tcb &current, const tcb &woken) const override;
+	virtual u64 next_event() const override;
+	virtual const char *name() const { return "earliest deadline first"; }
+
+	bool contains(const tcb &t) const { return t.rq_prev != nullptr || ready_head_ == &t || throttled_head_ == &t; }
+
+private:
+	tcb *ready_head_;
+	tcb *throttled_head_;
+
+	static u64 next_period_start(const tcb &t) { return t.dl_abs_deadline - t.dl_deadline + t.dl_period; }
+
+	void charge(tcb &t);
+	void replenish(u64 now);
+
+	void enqueue(tcb &t);
+	void dequeue(tcb &t);
+};
+} // namespace stacsos::kernel::sched::alg
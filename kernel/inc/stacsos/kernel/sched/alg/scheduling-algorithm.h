@@ -14,9 +14,39 @@ class tcb;
 namespace stacsos::kernel::sched::alg {
 class scheduling_algorithm {
 public:
+	virtual ~scheduling_algorithm() { }
+
 	virtual void add_to_runqueue(tcb &tcb) = 0;
 	virtual void remove_from_runqueue(tcb &tcb) = 0;
 	virtual tcb *select_next_task(tcb *current) = 0;
+
+	/**
+	 * @brief Chooses a queued task that is not currently executing, and that is allowed to run on the
+	 * given core, so that it can be migrated there, and removes it from the run queue.
+	 *
+	 * @return tcb* The task to migrate, or nullptr if there isn't one (or the algorithm doesn't support migration).
+	 */
+	virtual tcb *steal_task(int core_id) { return nullptr; }
+
+	/**
+	 * @brief Removes any one task from the run queue, regardless of whether it is executing, so that the run
+	 * queue can be handed over to a different algorithm.  Called repeatedly until the run queue is empty.
+	 *
+	 * @return tcb* The removed task, or nullptr if the run queue is empty.
+	 */
+	virtual tcb *drain_task() { return nullptr; }
+
+	/**
+	 * @brief Decides whether a task that has just been added to the run queue is important enough to
+	 * preempt the current task before its time slice has expired.
+	 */
+	virtual bool should_preempt(const tcb &current, const tcb &woken) const { return false; }
+
+	/**
+	 * @brief Returns the time (in timestamp counter ticks) at which the algorithm next needs to make a
+	 * scheduling decision, regardless of the current task's time slice, or zero if there isn't one.
+	 */
+	virtual u64 next_event() const { return 0; }
 	virtual const char *name() const = 0;
 };
 } // namespace stacsos::kernel::sched::alg
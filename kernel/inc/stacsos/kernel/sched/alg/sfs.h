@@ -17,6 +17,8 @@ public:
 	virtual void add_to_runqueue(tcb &tcb) override { runqueue_.append(&tcb); }
 	virtual void remove_from_runqueue(tcb &tcb) override { runqueue_.remove(&tcb); }
 	virtual tcb *select_next_task(tcb *current) override;
+	virtual tcb *steal_task(int core_id) override;
+	virtual tcb *drain_task() override { return runqueue_.empty() ? nullptr : runqueue_.dequeue(); }
 	virtual const char *name() const { return "simple fair"; }
 
 private:
@@ -7,11 +7,14 @@
  */
 #pragma once
 
-#include <stacsos/list.h>
+#include <stacsos/kernel/sched/wait-queue.h>
 
 namespace stacsos::kernel::sched {
-class thread;
-
+/**
+ * An event that threads can wait to be triggered.  An auto-reset event releases a single waiter per
+ * trigger (or the next thread to wait, if nobody is waiting), whereas a manual-reset event stays
+ * triggered, and releases everyone, until it is reset.
+ */
 template <bool AUTO_RESET> class event {
 public:
 	event()
@@ -20,11 +23,15 @@ public:
 	}
 
 	void trigger();
+	void reset();
 	void wait();
+	bool wait(u64 timeout_us);
 
 private:
 	bool triggered_;
-	list<thread *> wait_list_;
+	wait_queue waiters_;
+
+	bool try_consume();
 };
 
 using auto_reset_event = event<true>;
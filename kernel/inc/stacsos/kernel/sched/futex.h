@@ -0,0 +1,40 @@
+/* SPDX-License-Identifier: MIT */
+
+/* StACSOS - Kernel
+ *
+ * Copyright (c) University of St Andrews 2024
+ * Tom Spink <tcs6@st-andrews.ac.uk>
+ */
+#pragma once
+
+#include <stacsos/kernel/sched/wait-queue.h>
+
+namespace stacsos::kernel::sched {
+class process;
+
+enum class futex_result { ok, would_block, timed_out, invalid_argument };
+
+/**
+ * Fast userspace mutex support.  Userspace threads block on a 32-bit word in their address space, and
+ * the kernel keeps waiters in a hashed table of wait queues, keyed on the physical address of the word.
+ */
+class futex {
+	DEFINE_SINGLETON(futex)
+
+public:
+	futex_result wait(process &owner, u64 address, u32 expected, u64 timeout_us);
+	futex_result wake(process &owner, u64 address, u64 count, u64 &nr_woken);
+
+private:
+	futex() { }
+
+	static const int nr_buckets = 64;
+
+	// Each bucket is shared by every futex whose key hashes to it, so waiters are queued with their key,
+	// and only those with a matching key are woken.
+	wait_queue buckets_[nr_buckets];
+
+	bool translate(process &owner, u64 address, u64 &key);
+	wait_queue &bucket_for(u64 key) { return buckets_[(key >> 2) % nr_buckets]; }
+};
+} // namespace stacsos::kernel::sched
@@ -0,0 +1,31 @@
+/* SPDX-License-Identifier: MIT */
+
+/* StACSOS - Kernel
+ *
+ * Copyright (c) University of St Andrews 2024
+ * Tom Spink <tcs6@st-andrews.ac.uk>
+ */
+#pragma once
+
+#include <stacsos/memops.h>
+
+namespace stacsos::kernel::sched {
+
+/**
+ * A histogram of latencies, in log2-sized buckets: bucket i counts latencies of at least 2^i (and
+ * less than 2^(i+1)) nanoseconds, except for the last bucket, which counts everything longer.
+ */
+struct latency_histogram {
+	static const int nr_buckets = 32;
+
+	u64 buckets[nr_buckets];
+
+	latency_histogram() { memops::bzero(buckets, sizeof(buckets)); }
+
+	void record(u64 ns)
+	{
+		int bucket = ns ? 63 - __builtin_clzll(ns) : 0;
+		buckets[bucket < nr_buckets ? bucket : nr_buckets - 1]++;
+	}
+};
+} // namespace stacsos::kernel::sched
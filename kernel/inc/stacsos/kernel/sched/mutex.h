@@ -0,0 +1,91 @@
+/* SPDX-License-Identifier: MIT */
+
+/* StACSOS - Kernel
+ *
+ * Copyright (c) University of St Andrews 2024
+ * Tom Spink <tcs6@st-andrews.ac.uk>
+ */
+#pragma once
+
+#include <stacsos/kernel/sched/schedulable-entity.h>
+#include <stacsos/kernel/sched/wait-queue.h>
+
+namespace stacsos::kernel::sched {
+/**
+ * A sleeping lock, for resources that may be held for a long time (e.g. across disk I/O).  Contended
+ * lockers spin for as long as the holder is running on another core, because it's likely to release the
+ * lock soon, and otherwise go to sleep.  This must only be used from thread context, with interrupts
+ * enabled.
+ */
+class mutex {
+public:
+	mutex()
+		: owner_(nullptr)
+	{
+	}
+
+	void lock();
+	bool try_lock();
+	void unlock();
+
+private:
+	DELETE_DEFAULT_COPY_AND_MOVE(mutex);
+
+	tcb *owner_;
+	wait_queue waiters_;
+
+	bool spin_on_owner();
+};
+
+/**
+ * A RAII helper that holds a mutex for the duration of a scope.
+ */
+class unique_mutex_lock {
+public:
+	explicit unique_mutex_lock(mutex &m)
+		: m_(m)
+	{
+		m_.lock();
+	}
+
+	~unique_mutex_lock() { m_.unlock(); }
+
+	unique_mutex_lock(const unique_mutex_lock &) = delete;
+	unique_mutex_lock &operator=(const unique_mutex_lock &) = delete;
+
+private:
+	mutex &m_;
+};
+
+/**
+ * A sleeping reader-writer lock.  Any number of readers may hold the lock at once, or a single writer.
+ * Waiting writers hold off new readers, so that a stream of readers can't starve them.
+ */
+class rw_semaphore {
+public:
+	rw_semaphore()
+		: state_(0)
+		, writers_waiting_(0)
+	{
+	}
+
+	void down_read();
+	bool try_down_read();
+	void up_read();
+
+	void down_write();
+	bool try_down_write();
+	void up_write();
+
+private:
+	DELETE_DEFAULT_COPY_AND_MOVE(rw_semaphore);
+
+	// The number of readers holding the lock, or -1 if a writer holds it.  This (and the count of waiting
+	// writers) is protected by the wait queue lock.
+	int state_;
+	unsigned int writers_waiting_;
+	wait_queue waiters_;
+
+	bool can_read() const { return state_ >= 0 && writers_waiting_ == 0; }
+};
+} // namespace stacsos::kernel::sched
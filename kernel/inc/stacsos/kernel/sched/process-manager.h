@@ -7,6 +7,7 @@
  */
 #pragma once
 
+#include <stacsos/kernel/lock.h>
 #include <stacsos/kernel/sched/process.h>
 #include <stacsos/list.h>
 #include <stacsos/memory.h>
@@ -28,9 +29,15 @@ public:
 	shared_ptr<process> create_process(const char *path, const char *args);
 
 	shared_ptr<process> kernel_process() const { return kernel_process_; }
+	list<shared_ptr<process>> processes();
+
+	void remove_process(process &proc);
 
 private:
 	shared_ptr<process> kernel_process_;
 	list<shared_ptr<process>> active_processes_;
+	spinlock_irq active_processes_lock_;
+
+	void add_process(shared_ptr<process> proc);
 };
 } // namespace stacsos::kernel::sched
@@ -9,8 +9,8 @@
 
 #include <stacsos/kernel/mem/address-space.h>
 #include <stacsos/kernel/mem/memory-manager.h>
-#include <stacsos/kernel/sched/event.h>
 #include <stacsos/kernel/sched/thread.h>
+#include <stacsos/kernel/sched/wait-queue.h>
 #include <stacsos/list.h>
 #include <stacsos/memory.h>
 
@@ -44,17 +44,25 @@ public:
 
 	mem::address_space &addrspace() const { return *vma_; }
 
-	auto_reset_event &state_changed_event() { return state_changed_event_; }
+	list<shared_ptr<thread>> threads();
+
+	void wait_for_state_change(process_state from);
+
+	bool release_resources();
 
 private:
 	exec_privilege priv_;
 	process_state state_;
-	auto_reset_event state_changed_event_;
+	wait_queue state_changed_queue_;
 
 	mem::address_space *vma_;
+
+	// Protects the thread list and the user stack cursor, as threads may be created concurrently.
+	spinlock_irq lock_;
 	list<shared_ptr<thread>> threads_;
 	u64 next_user_stack_;
 
 	void on_thread_stopped(thread &thread);
+	void terminate();
 };
 } // namespace stacsos::kernel::sched
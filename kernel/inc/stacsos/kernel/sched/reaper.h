@@ -0,0 +1,59 @@
+/* SPDX-License-Identifier: MIT */
+
+/* StACSOS - Kernel
+ *
+ * Copyright (c) University of St Andrews 2024
+ * Tom Spink <tcs6@st-andrews.ac.uk>
+ */
+#pragma once
+
+#include <stacsos/kernel/sched/wait-queue.h>
+#include <stacsos/list.h>
+
+namespace stacsos::kernel::sched {
+class thread;
+class process;
+
+/**
+ * Frees the resources of terminated threads and processes.  A thread can't free its own kernel stack (it's still
+ * running on it), and a process's page tables may still be loaded on some core, so this is left to a kernel thread,
+ * which waits until nothing is using them any more.
+ */
+class reaper {
+	DEFINE_SINGLETON(reaper)
+
+public:
+	reaper()
+		: new_work_(false)
+		, waiting_(false)
+		, release_seq_(0)
+	{
+	}
+
+	void init();
+
+	void reap_thread(thread &t);
+	void reap_process(process &p);
+
+	/**
+	 * Called by a core when it lets go of something the reaper may be waiting for, i.e. once it has left the kernel
+	 * stack of a task it switched away from, or loaded a different address space.
+	 */
+	void resources_released();
+
+private:
+	wait_queue work_;
+	list<thread *> threads_;
+	list<process *> processes_;
+
+	// Whether there is work that hasn't been looked at yet, and whether the last look found anything still in use.
+	bool new_work_;
+	bool waiting_;
+
+	// Bumped whenever a core lets go of something, while the reaper is waiting.
+	u64 release_seq_;
+
+	static void reaper_thread_proc();
+	void reap();
+};
+} // namespace stacsos::kernel::sched
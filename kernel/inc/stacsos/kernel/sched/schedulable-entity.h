@@ -8,7 +8,9 @@
 #pragma once
 
 #include <stacsos/kernel/arch/x86/machine-context.h>
+#include <stacsos/kernel/sched/latency-histogram.h>
 #include <stacsos/memops.h>
+#include <stacsos/sched-policy.h>
 
 namespace stacsos::kernel::arch {
 class core;
@@ -26,21 +28,61 @@ struct tcb {
 	u64 start_time;	// 28
 	u64 stop_time;	// 30
 	u64 run_time;	// 38
+	stacsos::kernel::arch::core *running_on; // 40
+	tcb *switched_from; // 48
+	u64 vruntime; // 50
+	u64 vruntime_charged; // 58
+	u32 weight; // 60
+	u32 rq_index; // 64
+	u64 slice_expiry; // 68
+	sched_policy policy; // 70
+	u32 rt_priority; // 74
+	tcb *rq_next; // 78
+	tcb *rq_prev; // 80
+	u64 dl_runtime; // 88
+	u64 dl_deadline; // 90
+	u64 dl_period; // 98
+	u64 dl_abs_deadline; // a0
+	u64 dl_budget; // a8
+	u64 dl_charged; // b0
+	u64 wakeup_time; // b8
+	u64 affinity; // c0
+	u64 switch_frame; // c8
+	void *fpu_state; // d0
+	s32 fpu_core; // d8
+	bool dl_throttled; // dc
+	bool migrating; // dd
+	s32 dl_core; // de
 } __packed;
 
+// Returns true if the task's affinity mask allows it to run on the given core.
+static inline bool can_run_on(const tcb &t, int core_id) { return (t.affinity >> core_id) & 1; }
+
 class schedulable_entity {
+	friend class scheduler;
+	friend class arch::core;
+
 public:
 	schedulable_entity()
 		: owning_core_(nullptr)
 	{
 		memops::bzero(&tcb_, sizeof(tcb_));
+		tcb_.affinity = ~0ull;
+		tcb_.fpu_core = -1;
+		tcb_.dl_core = -1;
 	}
 
 	const tcb *get_tcb() const { return &tcb_; }
 	tcb *get_tcb() { return &tcb_; }
 
+	const latency_histogram &wakeup_latency() const { return wakeup_latency_; }
+
+	// The core whose run queue this is on, if any.
+	arch::core *owning_core() const { return *(arch::core *volatile *)&owning_core_; }
+
 private:
 	arch::core *owning_core_;
+	latency_histogram wakeup_latency_;
 
 protected:
 	__aligned(16) tcb tcb_;
@@ -7,6 +7,9 @@
  */
 #pragma once
 
+#include <stacsos/kernel/arch/core-manager.h>
+#include <stacsos/kernel/lock.h>
+
 namespace stacsos::kernel::sched {
 class schedulable_entity;
 
@@ -14,10 +17,27 @@ class scheduler {
 	DEFINE_SINGLETON(scheduler);
 
 private:
-	scheduler() { }
+	scheduler()
+	{
+		for (int i = 0; i < arch::core_manager::max_cores; i++) {
+			reserved_bandwidth_[i] = 0;
+		}
+	}
 
 public:
+	// Deadline task bandwidth is expressed as a fixed-point fraction of one core.
+	static const u64 bandwidth_unit = 1 << 20;
+
 	void add_to_schedule(schedulable_entity &e);
 	void remove_from_schedule(schedulable_entity &e);
+
+	int reserve_bandwidth(u64 affinity, int old_core, u64 old_bandwidth, u64 new_bandwidth);
+	void release_bandwidth(int core_id, u64 bandwidth);
+
+private:
+	spinlock_irq bandwidth_lock_;
+
+	// The bandwidth reserved by deadline tasks on each core, indexed by core id.
+	u64 reserved_bandwidth_[arch::core_manager::max_cores];
 };
 } // namespace stacsos::kernel::sched
@@ -7,14 +7,32 @@
  */
 #pragma once
 
-#include <stacsos/list.h>
+#include <stacsos/kernel/arch/core-manager.h>
+#include <stacsos/kernel/lock.h>
+
+namespace stacsos::kernel::arch {
+class core;
+}
 
 namespace stacsos::kernel::sched {
 class thread;
 
-struct sleeping_thread {
+/**
+ * A wakeup timer for a thread.  This is embedded in the thread, so that no allocation is needed to
+ * go to sleep, and it is linked directly into a per-core pairing heap, ordered by deadline.
+ */
+struct sleep_timer {
 	thread *thr;
 	u64 wakeup_deadline;
+	int core; // The core whose queue holds this timer, or -1 if it isn't armed.
+	bool expiring; // Set while check_wakeup() is resuming the thread, after the timer left its queue.
+
+	// Links the timer into check_wakeup()'s list of expired timers, which is walked after the queue
+	// lock is dropped, so it can't share the heap links with a timer that's being re-armed.
+	sleep_timer *next_expired;
+
+	// Pairing heap links.  prev points to the parent for a first child, or the left sibling otherwise.
+	sleep_timer *child, *sibling, *prev;
 };
 
 class sleeper {
@@ -22,13 +40,32 @@ class sleeper {
 
 public:
 	void sleep_ms(u64 duration_ms);
+	void arm(thread &t, u64 wakeup_deadline);
 	void check_wakeup();
+	u64 next_deadline(arch::core &c);
+	bool cancel(thread &t);
 
 private:
 	sleeper() { }
 
-	list<sleeping_thread *> sleeping_;
+	struct timer_queue {
+		timer_queue()
+			: root(nullptr)
+		{
+		}
+
+		spinlock_irq lock;
+		sleep_timer *root;
+	};
+
+	timer_queue queues_[arch::core_manager::max_cores];
 
 	void do_sleep(u64 wakeup_deadline);
+	static void wait_for_expiry(sleep_timer &st);
+
+	static sleep_timer *meld(sleep_timer *a, sleep_timer *b);
+	static sleep_timer *merge_pairs(sleep_timer *first);
+	static void insert(timer_queue &q, sleep_timer &t);
+	static void remove(timer_queue &q, sleep_timer &t);
 };
 } // namespace stacsos::kernel::sched
@@ -8,12 +8,10 @@
 #pragma once
 
 #include <stacsos/kernel/arch/x86/machine-context.h>
-#include <stacsos/kernel/sched/event.h>
+#include <stacsos/kernel/lock.h>
 #include <stacsos/kernel/sched/schedulable-entity.h>
-
-namespace stacsos::kernel::mem {
-class page;
-}
+#include <stacsos/kernel/sched/sleeper.h>
+#include <stacsos/kernel/sched/wait-queue.h>
 
 namespace stacsos::kernel::arch {
 class core;
@@ -24,22 +22,31 @@ using namespace stacsos::kernel::arch;
 
 enum class thread_states { created, runnable, running, suspended, terminated };
 
+enum class deadline_result { ok, invalid_argument, over_subscribed };
+
 class process;
 
 class thread : public schedulable_entity {
 public:
-	static const int stack_size_order = 4;
-	static const size_t stack_size = (1 << stack_size_order) * PAGE_SIZE;
-
 	thread(process &owner, u64 ep = 0, void *ep_arg = nullptr, u64 user_stack = 0);
 
 	thread_states state() const { return state_; }
-	auto_reset_event &state_changed_event() { return state_changed_event_; }
+	sched::sleep_timer &sleep_timer() { return sleep_timer_; }
+	wait_queue_entry &wait_entry() { return wait_entry_; }
 
 	void start();
 	void stop();
 	void suspend();
 	void resume();
+	void join();
+
+	bool release_resources();
+	bool resources_released() const { return kernel_stack_ == nullptr; }
+
+	bool set_sched_policy(sched_policy policy, u32 rt_priority);
+	deadline_result set_deadline(u64 runtime_us, u64 deadline_us, u64 period_us);
+	bool set_affinity(u64 mask);
+	void finish_migration();
 
 	process &owner() const { return owner_; }
 
@@ -49,14 +56,18 @@ private:
 	static __noreturn void task_entry_trampoline(thread *task);
 	void init_tcb();
 	bool is_self() const;
-	void change_state(thread_states new_state);
+	bool change_state(thread_states new_state);
+	u64 deadline_bandwidth() const;
 
 	process &owner_;
 	u64 ep_;
 	void *arg_;
 	thread_states state_;
-	mem::page *kernel_stack_;
+	spinlock_irq state_lock_;
+	void *kernel_stack_;
 	u64 user_stack_;
-	auto_reset_event state_changed_event_;
+	sched::sleep_timer sleep_timer_;
+	wait_queue_entry wait_entry_;
+	wait_queue join_queue_;
 };
 } // namespace stacsos::kernel::sched
@@ -0,0 +1,94 @@
+/* SPDX-License-Identifier: MIT */
+
+/* StACSOS - Kernel
+ *
+ * Copyright (c) University of St Andrews 2024
+ * Tom Spink <tcs6@st-andrews.ac.uk>
+ */
+#pragma once
+
+#include <stacsos/kernel/lock.h>
+
+namespace stacsos::kernel::sched {
+class thread;
+class wait_queue;
+
+/**
+ * A thread's link into a wait queue.  This is embedded in the thread, since a thread can only wait on
+ * one queue at a time, so that no allocation is needed to wait.
+ */
+struct wait_queue_entry {
+	thread *thr;
+	u64 key;
+	wait_queue_entry *next, *prev;
+	wait_queue *queue;
+	bool queued;
+};
+
+/**
+ * A FIFO queue of threads waiting for some condition to become true.  The condition is always checked,
+ * and waiters queued, under the queue's lock, so a waker that changes the condition under the same lock
+ * (or changes it, and then calls one of the wake functions) can't miss a waiter.
+ */
+class wait_queue {
+public:
+	wait_queue()
+		: head_(nullptr)
+		, tail_(nullptr)
+	{
+	}
+
+	/**
+	 * @brief Blocks the current thread until the condition (which is evaluated with the queue's lock held)
+	 * returns true.  If the timeout is non-zero, gives up after that many microseconds, and returns false.
+	 */
+	template <typename F> bool wait_until(F cond, u64 timeout_us = 0)
+	{
+		u64 deadline = timeout_us ? deadline_after_us(timeout_us) : 0;
+
+		while (true) {
+			{
+				unique_irq_lock l(lock_);
+
+				if (cond()) {
+					return true;
+				}
+
+				if (!enqueue_current_locked(0, deadline)) {
+					return false;
+				}
+			}
+
+			block_current();
+		}
+	}
+
+	void wake_one() { wake_n(1); }
+	void wake_all() { wake_n(~0ull); }
+	u64 wake_n(u64 n);
+
+	// For callers that need to update the condition and wake waiters atomically, e.g. because the
+	// queue may be destroyed as soon as a waiter sees the condition change.  These must be called with
+	// the lock held.
+	spinlock_irq &lock() { return lock_; }
+	u64 wake_n_locked(u64 n);
+	u64 wake_keyed_locked(u64 key, u64 n);
+
+	// Lower-level interface, for waiters that need to do more than check a condition.  The current
+	// thread is queued with the given key (and an optional TSC deadline), and must then call
+	// block_current() after dropping the lock.  Returns false if the deadline has already passed.
+	bool enqueue_current_locked(u64 key, u64 deadline);
+	bool block_current();
+
+	static u64 deadline_after_us(u64 timeout_us);
+
+	// Takes a thread off whichever queue it is waiting on, e.g. because the thread has been terminated.
+	static void cancel(wait_queue_entry &e);
+
+private:
+	spinlock_irq lock_;
+	wait_queue_entry *head_, *tail_;
+
+	void dequeue(wait_queue_entry &e);
+};
+} // namespace stacsos::kernel::sched
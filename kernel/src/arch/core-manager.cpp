@@ -33,7 +33,12 @@ void core_manager::go()
 		}
 
 		dprintf("starting core %d...\n", cores_[i]->id_);
-		//cores_[i]->status_ = cores_[i]->remote_run() ? core_status::online : core_status::error;
+
+		// The remote core marks itself as online once it starts running.
+		if (!cores_[i]->remote_run()) {
+			dprintf("core %d failed to start\n", cores_[i]->id_);
+			cores_[i]->status_ = core_status::error;
+		}
 	}
 
 	// Start this core running
@@ -10,10 +10,12 @@
 #include <stacsos/kernel/arch/timer.h>
 #include <stacsos/kernel/arch/x86/cregs.h>
 #include <stacsos/kernel/arch/x86/machine-context.h>
+#include <stacsos/kernel/arch/x86/x86-core.h>
 #include <stacsos/kernel/debug.h>
 #include <stacsos/kernel/mem/memory-manager.h>
 #include <stacsos/kernel/mem/page-allocator.h>
 #include <stacsos/kernel/sched/schedulable-entity.h>
+#include <stacsos/kernel/sched/sleeper.h>
 
 using namespace stacsos::kernel::arch;
 using namespace stacsos::kernel::arch::x86;
@@ -32,7 +34,7 @@ core &core::this_core()
 static void idle_thread()
 {
 	while (true) {
-		__relax();
+		core::this_core().idle();
 	}
 }
 
@@ -47,6 +49,7 @@ void core::run()
 	}
 
 	// Initialise the IDLE thread, for doing nothing when there are no tasks to run.
+	memops::bzero(&idle_thread_, sizeof(idle_thread_));
 	void *idle_thread_stack = memory_manager::get().pgalloc().allocate_pages(0, page_allocation_flags::zero)->base_address_ptr();
 
 	idle_thread_.mcontext = (machine_context *)idle_thread_stack;
@@ -58,11 +61,21 @@ void core::run()
 	idle_thread_.mcontext->gs = (u64)&idle_thread_;
 	idle_thread_.cr3 = memory_manager::get().root_address_space().pgtable().effective_cr3();
 	idle_thread_.kernel_stack = (u64)idle_thread_stack + PAGE_SIZE;
+	idle_thread_.running_on = this;
 
 	set_current_tcb(&idle_thread_);
+	status_ = core_status::online;
 
-	dprintf("core [%d]: run\n", id());
-	local_timer().start(100); // 100 Hz
+	dprintf("core [%d]: run (%s)\n", id(), tickless_ ? "tickless" : "periodic");
+
+	current_ = &idle_thread_;
+	next_balance_ = __builtin_ia32_rdtsc() + balance_period();
+
+	if (tickless_) {
+		program_timer(0);
+	} else {
+		local_timer().start(tick_frequency);
+	}
 
 	// This will also enable interrupts, because the IF flag is set in rflags.
 	x86_return_to_task();
@@ -80,20 +93,319 @@ void core::schedule()
 		current->run_time += delta;
 	}
 
-	// Select the next task for execution
-	// TODO: Check task quantum expiry
-	tcb *next = sched_alg_->select_next_task(current);
+	// A task that may no longer run on this core (e.g. its affinity has changed, or it's a deadline task that has been
+	// given a reservation elsewhere) is taken off the run queue here, and placed on another core once this core has
+	// switched away from it (see x86_release_task).
+	if (current && current != &idle_thread_ && current->entity->owning_core_ == this && !may_run_here(*current)) {
+		if (remove_from_runqueue(*current)) {
+			current->migrating = true;
+		}
+	}
+
+	// A scheduling decision may also be due because of an event in the scheduling algorithm, e.g. a
+	// deadline task's budget being replenished.
+	u64 alg_event = sched_alg_->next_event();
+	bool preempt = need_resched_ || (alg_event && now >= alg_event);
+	need_resched_ = false;
+
+	// Keep running the current task if it's still runnable on this core, its time slice hasn't
+	// expired, and nothing more important has woken up.
+	if (current && current != &idle_thread_ && !preempt && current->entity->owning_core_ == this && now < current->slice_expiry) {
+		current->start_time = now;
+
+		if (tickless_) {
+			program_timer(current->slice_expiry);
+		}
+
+		return;
+	}
+
+	// Select the next task for execution.  It's claimed for this core before the run queue lock is dropped, so
+	// that nothing (e.g. the reaper, if the task is terminated) sees it as not running in the meantime.  The
+	// choice is published at the same time, so that a task added after this point sees an idle core (and kicks
+	// it), rather than the task that is being switched away from.
+	tcb *next;
+	{
+		unique_irq_lock l(runqueue_lock_);
+		next = sched_alg_->select_next_task(current);
+
+		if (next) {
+			next->running_on = this;
+		}
+
+		current_ = next ? next : &idle_thread_;
+	}
+
+	// If there's nothing to run here, try to take some work from the busiest core before going idle.
+	if (!next) {
+		core *busiest = find_busiest_core();
+
+		if (busiest && pull_task_from(*busiest)) {
+			unique_irq_lock l(runqueue_lock_);
+			next = sched_alg_->select_next_task(current);
+
+			if (next) {
+				next->running_on = this;
+				current_ = next;
+			}
+		}
+	}
+
 	if (!next) {
 		next = &idle_thread_;
 	}
 
-	// Update the next task's start time
+	// Update the next task's start time, and give it a new time slice if it's being switched in, or
+	// if it has used up its old one.
 	next->start_time = now;
 
+	if (next != current || now >= next->slice_expiry) {
+		u64 slice = time_slice(*next);
+		next->slice_expiry = slice ? now + slice : no_slice_expiry;
+	}
+
+	// If we're switching tasks, the previous task is released for other cores to run once
+	// we've left its kernel stack (see TRAP_COMPLETE).
+	if (next != current) {
+		next->switched_from = current;
+	}
+
+	// If the next task has just woken up, record how long it waited in the run queue.
+	if (next->wakeup_time) {
+		u64 ticks_per_us = x86_core::this_core().local_tsc().frequency() / 1000000;
+		u64 latency_ns = now > next->wakeup_time ? ((now - next->wakeup_time) * 1000) / ticks_per_us : 0;
+
+		wakeup_latency_.record(latency_ns);
+		next->entity->wakeup_latency_.record(latency_ns);
+		next->wakeup_time = 0;
+	}
+
+	if (tickless_) {
+		program_timer(next == &idle_thread_ ? 0 : next->slice_expiry);
+	}
+
 	// Activate the task.
 	set_current_tcb(next);
 }
 
+/**
+ * Returns true if the given task is allowed to run on this core.
+ */
+bool core::may_run_here(const tcb &t) const
+{
+	if (t.policy == sched_policy::deadline && t.dl_core >= 0) {
+		return t.dl_core == id_;
+	}
+
+	return can_run_on(t, id_);
+}
+
+/**
+ * Returns the length of a time slice for the given task, in timestamp counter ticks, or zero if the
+ * task's time slice never expires.
+ */
+u64 core::time_slice(const tcb &t) const
+{
+	// A deadline task's slice is whatever is left of its budget, so that the budget is enforced by
+	// the timer interrupt.
+	if (t.policy == sched_policy::deadline) {
+		return t.dl_budget ? t.dl_budget : 1;
+	}
+
+	u64 ms = time_slice_ms_[t.policy < sched_policy::nr_policies ? (int)t.policy : (int)sched_policy::normal];
+	return (x86_core::this_core().local_tsc().frequency() * ms) / 1000;
+}
+
+/**
+ * Arms the local timer for the next event on this core, in tickless mode: either the end of the
+ * current time slice, the next sleeper deadline, the next scheduling algorithm event, or the next load
+ * balancing run.  The balancing run is always pending, so even an idle core wakes up periodically to
+ * pull work over from busy cores.
+ */
+void core::program_timer(u64 slice_expiry)
+{
+	u64 deadline = sleeper::get().next_deadline(*this);
+	deadline = deadline ? min(deadline, next_balance_) : next_balance_;
+
+	if (slice_expiry && slice_expiry != no_slice_expiry) {
+		deadline = deadline ? min(deadline, slice_expiry) : slice_expiry;
+	}
+
+	u64 alg_event = sched_alg_->next_event();
+	if (alg_event) {
+		deadline = deadline ? min(deadline, alg_event) : alg_event;
+	}
+
+	if (deadline) {
+		local_timer().start_oneshot(deadline);
+	} else {
+		local_timer().stop();
+	}
+}
+
+alg::scheduling_algorithm *core::create_fair_algorithm(const char *name)
+{
+	if (memops::strcmp(name, "sfs") == 0) {
+		return new alg::simple_fair_scheduler();
+	} else if (memops::strcmp(name, "cfs") == 0) {
+		return new alg::completely_fair_scheduler();
+	} else {
+		return nullptr;
+	}
+}
+
+bool core::set_fair_algorithm(const char *name)
+{
+	alg::scheduling_algorithm *fair_alg = create_fair_algorithm(name);
+	if (!fair_alg) {
+		return false;
+	}
+
+	alg::scheduling_algorithm *old;
+	{
+		unique_irq_lock l(runqueue_lock_);
+		old = sched_alg_->replace_fair(fair_alg);
+
+		// The task that is running now was chosen by the old algorithm, so let the new one have its say
+		// straight away.
+		need_resched_ = true;
+	}
+
+	dprintf("core%d: switched scheduling algorithm from %s to %s\n", id_, old->name(), fair_alg->name());
+	delete old;
+
+	if (this != &this_core()) {
+		kick();
+	}
+
+	return true;
+}
+
+const char *core::sched_alg_name()
+{
+	unique_irq_lock l(runqueue_lock_);
+	return sched_alg_->name();
+}
+
+void core::add_to_runqueue(tcb &tcb)
+{
+	unique_irq_lock l(runqueue_lock_);
+
+	sched_alg_->add_to_runqueue(tcb);
+	tcb.entity->owning_core_ = this;
+	nr_runnable_++;
+
+	// If this core is idling, it may not notice the new task for a while (or at all, in tickless
+	// mode), so give it a nudge.  Likewise if the new task should preempt the running one.
+	// The kick does nothing if this is the same core (e.g. a task woken up by an interrupt that arrived
+	// while idling), so the idle task also checks for a pending reschedule before it sleeps.
+	auto *running = current_;
+	if (running == &idle_thread_) {
+		need_resched_ = true;
+		kick();
+	} else if (running && sched_alg_->should_preempt(*running, tcb)) {
+		need_resched_ = true;
+		kick();
+	}
+}
+
+bool core::remove_from_runqueue(tcb &tcb)
+{
+	unique_irq_lock l(runqueue_lock_);
+
+	// The task may have been migrated to another core before we got the lock.
+	if (tcb.entity->owning_core_ != this) {
+		return false;
+	}
+
+	sched_alg_->remove_from_runqueue(tcb);
+	tcb.entity->owning_core_ = nullptr;
+	nr_runnable_--;
+
+	return true;
+}
+
+core *core::find_busiest_core()
+{
+	core *busiest = nullptr;
+
+	for (auto *c : core_manager::get().cores()) {
+		if (c == this || c->status() != core_status::online || c->runqueue_length() == 0) {
+			continue;
+		}
+
+		if (busiest == nullptr || c->runqueue_length() > busiest->runqueue_length()) {
+			busiest = c;
+		}
+	}
+
+	return busiest;
+}
+
+/**
+ * Migrates one task from the given core's run queue onto this core's run queue.  Returns true if a
+ * task was migrated.
+ */
+bool core::pull_task_from(core &src)
+{
+	// Both run queues must be locked while the task is moved, so that it's never missing from both of
+	// them.  The locks are always taken in core id order, so that two cores pulling from each other at
+	// the same time can't deadlock.
+	core &first = id_ < src.id_ ? *this : src;
+	core &second = id_ < src.id_ ? src : *this;
+
+	unique_irq_lock l1(first.runqueue_lock_);
+	unique_irq_lock l2(second.runqueue_lock_);
+
+	tcb *t = src.sched_alg_->steal_task(id_);
+	if (!t) {
+		return false;
+	}
+
+	src.nr_runnable_--;
+
+	sched_alg_->add_to_runqueue(*t);
+	t->entity->owning_core_ = this;
+	nr_runnable_++;
+
+	return true;
+}
+
+/**
+ * Returns the time between load balancing runs, in timestamp counter ticks.
+ */
+u64 core::balance_period() const { return (x86_core::this_core().local_tsc().frequency() * balance_interval_ms) / 1000; }
+
+/**
+ * Called on every timer interrupt.  Periodically evens out the run queue lengths by pulling tasks from
+ * the busiest core.  The balancing runs are timed by the timestamp counter, rather than by counting
+ * ticks, so that they still happen in tickless mode (where program_timer() arms the timer for them).
+ */
+void core::balance()
+{
+	u64 now = __builtin_ia32_rdtsc();
+	if (now < next_balance_) {
+		return;
+	}
+
+	next_balance_ = now + balance_period();
+
+	core *busiest = find_busiest_core();
+	if (!busiest) {
+		return;
+	}
+
+	// Only pull across half the difference, so that the two cores end up roughly even.
+	unsigned int ours = runqueue_length();
+	unsigned int theirs = busiest->runqueue_length();
+
+	for (unsigned int i = 0; ours + 1 < theirs && i < (theirs - ours) / 2; i++) {
+		if (!pull_task_from(*busiest)) {
+			break;
+		}
+	}
+}
+
 void core::update_clock()
 {
 	// Update the internal clock
@@ -7,6 +7,7 @@
  */
 #include <stacsos/kernel/arch/x86/boot/multiboot.h>
 #include <stacsos/kernel/arch/x86/cpuid.h>
+#include <stacsos/kernel/arch/x86/cregs.h>
 #include <stacsos/kernel/debug.h>
 #include <stacsos/kernel/mem/memory-manager.h>
 #include <stacsos/kernel/mem/page-table.h>
@@ -94,17 +95,20 @@ static void clear_lower_mappings()
 	asm volatile("mov %0, %%cr3" ::"r"(cr3));
 }
 
+bool stacsos::kernel::arch::x86::x86_fsgsbase_enabled;
+
 static void check_arch_support()
 {
 	cpuid c;
 	c.initialise();
 
-#ifdef USE_FSGSBASE
-	if (!c.get_feature(cpuid_features::fsgsbase)) {
-		dprintf("\e4ERROR:\e7 FSGSBASE IS NOT SUPPORTED.\n");
-		abort();
+	// Use the FSGSBASE instructions if the processor has them, or fall back to the MSRs otherwise.
+	if (c.get_feature(cpuid_features::fsgsbase)) {
+		cr4::write(cr4::read() | cr4_flags::FSGSBASE);
+		x86_fsgsbase_enabled = true;
+	} else {
+		dprintf("\e4WARNING:\e7 FSGSBASE IS NOT SUPPORTED.\n");
 	}
-#endif
 }
 
 /* Architecture-indepentent kernel entry point */
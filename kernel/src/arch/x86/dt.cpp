@@ -194,6 +194,19 @@ bool interrupt_descriptor_table<MAX_NR_IDT_ENTRIES>::register_interrupt_gate(int
 	return true;
 }
 
+/**
+ * Makes the gate at the given index switch to a stack from the interrupt stack table (or not, if ist is zero).
+ * @param index The index of the gate to update.
+ * @param ist The interrupt stack table entry to use.
+ */
+template <int MAX_NR_IDT_ENTRIES> void interrupt_descriptor_table<MAX_NR_IDT_ENTRIES>::set_interrupt_stack(int index, u8 ist)
+{
+	if (index < 0 || index >= MAX_NR_IDT_ENTRIES)
+		return;
+
+	idt_[index].low = (idt_[index].low & ~(7ull << 32)) | ((u64)(ist & 7) << 32);
+}
+
 /**
  * Registers a trap gate in the IDT, at the given index.
  * @param index The index at which to register the trap gate.
@@ -247,5 +260,15 @@ void task_state_segment::set_kernel_stack(uintptr_t stack)
 	fields[0] = (u64)stack;
 }
 
+/**
+ * Sets one of the interrupt stack table entries (1-7), i.e. a known-good stack that particular interrupts can be
+ * configured to always switch to.
+ */
+void task_state_segment::set_interrupt_stack(int ist, uintptr_t stack)
+{
+	u64 *fields = (u64 *)((uintptr_t)tss_ + 4);
+	fields[3 + ist] = (u64)stack;
+}
+
 template class global_descriptor_table<16>;
 template class interrupt_descriptor_table<256>;
@@ -0,0 +1,118 @@
+/* SPDX-License-Identifier: MIT */
+
+/* StACSOS - Kernel
+ *
+ * Copyright (c) University of St Andrews 2024
+ * Tom Spink <tcs6@st-andrews.ac.uk>
+ */
+#include <stacsos/kernel/arch/x86/cpuid.h>
+#include <stacsos/kernel/arch/x86/cregs.h>
+#include <stacsos/kernel/arch/x86/fpu.h>
+#include <stacsos/kernel/debug.h>
+#include <stacsos/memops.h>
+
+using namespace stacsos;
+using namespace stacsos::kernel::arch::x86;
+
+bool fpu::use_xsave_, fpu::use_xsaveopt_;
+u32 fpu::state_size_;
+
+// The XSAVE state components that are enabled, if they're supported: x87, SSE, AVX and AVX-512.
+static const u64 xcr0_wanted = 0xe7;
+
+/**
+ * Prepares the extended state on the calling core.  This is called on every core as it comes
+ * online.
+ */
+void fpu::init()
+{
+	u32 eax = 1, ebx = 0, ecx = 0, edx = 0;
+	__cpuid(eax, ebx, ecx, edx);
+
+	use_xsave_ = !!(ecx & (1u << 26));
+
+	// Make sure the FPU isn't being emulated, and that WAIT/FWAIT honour CR0.TS.
+	cr0::write((cr0::read() & ~cr0_flags::emulation) | cr0_flags::monitor_coprocessor);
+
+	if (use_xsave_) {
+		cr4::write(cr4::read() | cr4_flags::OSXSAVE);
+
+		eax = 0xd;
+		ecx = 0;
+		__cpuid(eax, ebx, ecx, edx);
+
+		u64 xcr0 = (((u64)edx << 32) | eax) & xcr0_wanted;
+
+		// AVX-512 state can only be enabled alongside AVX.
+		if (!(xcr0 & 4)) {
+			xcr0 &= 7;
+		}
+
+		asm volatile("xsetbv" ::"c"(0), "a"((u32)xcr0), "d"((u32)(xcr0 >> 32)));
+
+		// Now that XCR0 has been set, EBX holds the size of the save area for the enabled components.
+		eax = 0xd;
+		ecx = 0;
+		__cpuid(eax, ebx, ecx, edx);
+		state_size_ = ebx;
+
+		eax = 0xd;
+		ecx = 1;
+		__cpuid(eax, ebx, ecx, edx);
+		use_xsaveopt_ = !!(eax & 1);
+	} else {
+		// Fall back to FXSAVE, which only covers the x87 and SSE state.
+		state_size_ = 512;
+	}
+
+	// No thread's state is loaded yet.
+	set_task_switched();
+}
+
+/**
+ * Allocates a save area for a thread's extended state, initialised so that restoring it puts the
+ * registers into their power-on state.
+ */
+void *fpu::alloc_state()
+{
+	// The save area must be 64-byte aligned.  The allocation it was carved out of is recorded just before it, so
+	// that it can be freed.
+	u8 *raw = new u8[state_size_ + 63 + sizeof(u8 *)];
+	u8 *state = (u8 *)(((uintptr_t)raw + sizeof(u8 *) + 63) & ~(uintptr_t)63);
+
+	((u8 **)state)[-1] = raw;
+
+	memops::bzero(state, state_size_);
+
+	*(u16 *)&state[0] = 0x37f; // FCW: all x87 exceptions masked
+	*(u32 *)&state[24] = 0x1f80; // MXCSR: all SSE exceptions masked
+
+	return state;
+}
+
+void fpu::free_state(void *state) { delete[] ((u8 **)state)[-1]; }
+
+void fpu::save(void *state)
+{
+	// XSAVEOPT skips components that haven't been modified since they were last restored from this area.
+	if (use_xsaveopt_) {
+		asm volatile("xsaveopt64 (%0)" ::"r"(state), "a"(~0u), "d"(~0u) : "memory");
+	} else if (use_xsave_) {
+		asm volatile("xsave64 (%0)" ::"r"(state), "a"(~0u), "d"(~0u) : "memory");
+	} else {
+		asm volatile("fxsave64 (%0)" ::"r"(state) : "memory");
+	}
+}
+
+void fpu::restore(void *state)
+{
+	if (use_xsave_) {
+		asm volatile("xrstor64 (%0)" ::"r"(state), "a"(~0u), "d"(~0u) : "memory");
+	} else {
+		asm volatile("fxrstor64 (%0)" ::"r"(state) : "memory");
+	}
+}
+
+void fpu::set_task_switched() { cr0::write(cr0::read() | cr0_flags::task_switched); }
+
+bool fpu::task_switched() { return (cr0::read() & cr0_flags::task_switched) == cr0_flags::task_switched; }
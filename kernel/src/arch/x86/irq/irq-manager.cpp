@@ -49,7 +49,17 @@ static irq_trap_fn_type irq_trap_functions[] = { x86_irq_trap_0, x86_irq_trap_1,
 	x86_irq_trap_241, x86_irq_trap_242, x86_irq_trap_243, x86_irq_trap_244, x86_irq_trap_245, x86_irq_trap_246, x86_irq_trap_247, x86_irq_trap_248,
 	x86_irq_trap_249, x86_irq_trap_250, x86_irq_trap_251, x86_irq_trap_252, x86_irq_trap_253, x86_irq_trap_254, x86_irq_trap_255 };
 
-extern "C" void x86_handle_irq(u8 irq_number, void *mcontext) { x86_core::this_core().irqmgr().handle_irq(irq_number, mcontext); }
+extern "C" void x86_handle_irq(u8 irq_number, void *mcontext)
+{
+	auto &c = x86_core::this_core();
+	c.irqmgr().handle_irq(irq_number, mcontext);
+
+	// An interrupt handler that woke up a more important task on this core can't kick the core, so reschedule on the
+	// way out instead.  Exceptions can be raised with locks held, so they are left alone.
+	if (irq_number >= 32 && c.resched_pending()) {
+		c.schedule();
+	}
+}
 
 static void unhandled_interrupt(u8 irq_number, void *mcontext, void *arg)
 {
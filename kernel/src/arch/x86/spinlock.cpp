@@ -0,0 +1,191 @@
+/* SPDX-License-Identifier: MIT */
+
+/* StACSOS - Kernel
+ *
+ * Copyright (c) University of St Andrews 2024
+ * Tom Spink <tcs6@st-andrews.ac.uk>
+ */
+#include <stacsos/kernel/lock.h>
+
+/*
+ * Spin Lock Implementations
+ *
+ * The implementation is chosen at build time (see stacsos-config.h).  Each provides raw_acquire, which
+ * returns true if the lock was contended (i.e. we had to wait for it), and raw_release.
+ */
+
+#if defined(SPINLOCK_MCS)
+
+/*
+ * An MCS queue lock, in the variant used by K42, which doesn't need callers to provide a queue node.
+ * The lock itself acts as the node of the current holder: its tail points to the last waiter (or to the
+ * lock itself, if it is held and nobody is waiting), and its next points to the first waiter.  Waiters
+ * queue up using nodes on their own stacks, and each spins on its own node, so a contended lock doesn't
+ * bounce a shared cache line between the waiters.  A waiter's node is only needed until it acquires the
+ * lock, at which point its successor (if any) is copied into the lock.
+ */
+
+#define MCS_WAITING ((spinlock_mcs_node *)1)
+
+static bool raw_acquire(spinlock_var_t *lv)
+{
+	spinlock_mcs_node *lock = &lv->mcs;
+
+	while (true) {
+		spinlock_mcs_node *prev = __atomic_load_n(&lock->tail, __ATOMIC_RELAXED);
+
+		if (!prev) {
+			// The lock looks free, so try to take it, with nobody waiting.
+			if (__atomic_compare_exchange_n(&lock->tail, &prev, lock, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+				return false;
+			}
+
+			continue;
+		}
+
+		spinlock_mcs_node me = { MCS_WAITING, nullptr };
+		if (!__atomic_compare_exchange_n(&lock->tail, &prev, &me, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+			continue;
+		}
+
+		// We're in the queue, so link ourselves in behind our predecessor (which may be the lock itself),
+		// and wait for it to hand over.
+		__atomic_store_n(&prev->next, &me, __ATOMIC_RELEASE);
+
+		while (__atomic_load_n(&me.tail, __ATOMIC_ACQUIRE) == MCS_WAITING) {
+			__relax();
+		}
+
+		// We now hold the lock, but our node is about to go out of scope, so the lock needs to take over as
+		// the holder's node.  If nobody has queued up behind us, point the tail back at the lock.
+		spinlock_mcs_node *succ = __atomic_load_n(&me.next, __ATOMIC_ACQUIRE);
+		if (!succ) {
+			lock->next = nullptr;
+
+			spinlock_mcs_node *expected = &me;
+			if (__atomic_compare_exchange_n(&lock->tail, &expected, lock, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+				return true;
+			}
+
+			// Somebody swapped themselves in as the tail, so wait for them to finish linking themselves in.
+			while (!(succ = __atomic_load_n(&me.next, __ATOMIC_ACQUIRE))) {
+				__relax();
+			}
+		}
+
+		lock->next = succ;
+		return true;
+	}
+}
+
+static void raw_release(spinlock_var_t *lv)
+{
+	spinlock_mcs_node *lock = &lv->mcs;
+	spinlock_mcs_node *succ = __atomic_load_n(&lock->next, __ATOMIC_ACQUIRE);
+
+	if (!succ) {
+		// Nobody is waiting, so try to mark the lock as free.
+		spinlock_mcs_node *expected = lock;
+		if (__atomic_compare_exchange_n(&lock->tail, &expected, nullptr, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+			return;
+		}
+
+		// Someone has just queued up, so wait for them to link themselves in.
+		while (!(succ = __atomic_load_n(&lock->next, __ATOMIC_ACQUIRE))) {
+			__relax();
+		}
+	}
+
+	// Hand the lock over to the first waiter.
+	__atomic_store_n(&succ->tail, nullptr, __ATOMIC_RELEASE);
+}
+
+#elif defined(SPINLOCK_TICKET)
+
+/*
+ * A ticket lock.  Each acquirer takes the next ticket, and waits until it's being served, so the lock is
+ * handed out in FIFO order.
+ */
+
+static bool raw_acquire(spinlock_var_t *lv)
+{
+	u32 old = __atomic_fetch_add(&lv->value, 1u << 16, __ATOMIC_ACQUIRE);
+	u16 ticket = (u16)(old >> 16);
+
+	if ((u16)old == ticket) {
+		return false;
+	}
+
+	while (__atomic_load_n(&lv->owner, __ATOMIC_ACQUIRE) != ticket) {
+		__relax();
+	}
+
+	return true;
+}
+
+static void raw_release(spinlock_var_t *lv)
+{
+	// Only the holder writes to the owner field, so this doesn't need to be a locked increment.
+	__atomic_store_n(&lv->owner, (u16)(lv->owner + 1), __ATOMIC_RELEASE);
+}
+
+#else
+
+/*
+ * A test-and-test-and-set lock.
+ */
+
+static bool raw_acquire(spinlock_var_t *lv)
+{
+	bool contended = false;
+
+	while (__atomic_exchange_n(&lv->value, 1, __ATOMIC_ACQUIRE)) {
+		contended = true;
+
+		while (__atomic_load_n(&lv->value, __ATOMIC_RELAXED)) {
+			__relax();
+		}
+	}
+
+	return contended;
+}
+
+static void raw_release(spinlock_var_t *lv) { __atomic_store_n(&lv->value, 0, __ATOMIC_RELEASE); }
+
+#endif
+
+static inline void record_acquisition(spinlock_var_t *lv, bool contended)
+{
+#if defined(SPINLOCK_STATS)
+	lv->acquisitions++;
+	if (contended) {
+		lv->contentions++;
+	}
+#endif
+}
+
+extern "C" void spinlock_acquire(spinlock_var_t *lv) { record_acquisition(lv, raw_acquire(lv)); }
+
+extern "C" void spinlock_release(spinlock_var_t *lv) { raw_release(lv); }
+
+/**
+ * Disables interrupts (saving the previous flags), and then acquires the lock.  Interrupts stay disabled
+ * while waiting, so that an interrupt handler can't try to take the lock while we're queued for it.
+ */
+extern "C" void spinlock_irq_acquire(spinlock_var_t *lv, u64 *flags)
+{
+	u64 f;
+	asm volatile("pushf; pop %0; cli" : "=r"(f)::"memory");
+	*flags = f;
+
+	record_acquisition(lv, raw_acquire(lv));
+}
+
+extern "C" void spinlock_irq_release(spinlock_var_t *lv, u64 flags)
+{
+	raw_release(lv);
+
+	if (flags & 0x200) {
+		asm volatile("sti" ::: "memory");
+	}
+}
@@ -23,8 +23,27 @@ void x2apic_timer::timer_irq_handler(u8 irq, void *context, void *arg)
 
 	sleeper::get().check_wakeup();
 
+	timer->lapic_.owner().balance();
 	timer->lapic_.owner().schedule();
 	timer->lapic_.eoi();
 }
 
+void x2apic_timer::start_oneshot(u64 deadline)
+{
+	tsc &t = lapic_.owner().local_tsc();
+	u64 now = t.read();
+
+	// Convert the deadline into LAPIC timer ticks.  Anything further than a second away is clamped (which
+	// also keeps the arithmetic from overflowing) -- the timer will just fire early, and be re-armed.
+	u64 delta = deadline > now ? min(deadline - now, t.frequency()) : 0;
+	u64 count = (delta * (lapic_.get_timer_frequency() >> 4)) / t.frequency();
+
+	lapic_.set_timer_one_shot();
+	lapic_.set_timer_divide(3);
+
+	// A count of zero would disarm the timer, so fire as soon as possible instead.
+	lapic_.set_timer_initial_count((u32)max(min(count, 0xffffffffull), 1ull));
+	lapic_.unmask_interrupts(x2apic_lvts::timer);
+}
+
 void x2apic_timer::init() { lapic_.set_timer_irq(lapic_.owner().irqmgr().allocate_irq(timer_irq_handler, this)); }
@@ -5,12 +5,16 @@
  * Copyright (c) University of St Andrews 2024
  * Tom Spink <tcs6@st-andrews.ac.uk>
  */
+#include <stacsos/kernel/arch/x86/cpuid.h>
 #include <stacsos/kernel/arch/x86/cregs.h>
+#include <stacsos/kernel/arch/x86/fpu.h>
 #include <stacsos/kernel/arch/x86/msr.h>
 #include <stacsos/kernel/arch/x86/pit.h>
 #include <stacsos/kernel/arch/x86/x86-core.h>
+#include <stacsos/kernel/config.h>
 #include <stacsos/kernel/debug.h>
 #include <stacsos/kernel/mem/memory-manager.h>
+#include <stacsos/kernel/sched/reaper.h>
 #include <stacsos/kernel/sched/thread.h>
 #include <stacsos/memops.h>
 
@@ -22,6 +26,7 @@ using namespace stacsos::kernel::mem;
 using namespace stacsos::kernel::sched;
 
 extern "C" void syscall_entry();
+extern "C" void x86_switch_to_next(x86_core *core);
 
 void x86_core::init()
 {
@@ -31,6 +36,25 @@ void x86_core::init()
 	// Initialise the local timestamp counter
 	tsc_.calibrate();
 
+	// Enable the extended register state (x87, SSE, AVX) for user threads.
+	fpu::init();
+
+	// Tag TLB entries with process-context identifiers, if the processor supports it, so that they survive
+	// address space switches.  PCIDE may only be set while the PCID field of CR3 is zero, which holds here
+	// because we are still running on the kernel's page tables.
+	cpuid c;
+	c.initialise();
+
+	if (c.get_feature(cpuid_features::pcid)) {
+		cr4::write(cr4::read() | cr4_flags::PCIDE);
+		pcid_enabled_ = true;
+	}
+
+	select_idle_mode();
+
+	kernel_cr3_ = memory_manager::get().root_address_space().pgtable().effective_cr3();
+	active_cr3_ = cr3::read();
+
 	// Initialise the Local APIC, and the Local APIC timer.
 	lapic_.init();
 	timer_.init();
@@ -38,10 +62,7 @@ void x86_core::init()
 	// Create a temporary TCB so we can take the first interrupt.  This is needed
 	// because the IRQ handling code needs somewhere to store a pointer to the saved
 	// context.
-	temporary_tcb.context_ptr = 0;
-	temporary_tcb.task_ptr = 0;
-	temporary_tcb.cr3 = 0;
-	temporary_tcb.kernel_stack = 0;
+	memops::bzero(&temporary_tcb, sizeof(temporary_tcb));
 
 	// Pop a pointer to this temporary TCB into GS.  It's not a /real/ tcb structure,
 	// so we can't use set_current_tcb.
@@ -59,18 +80,87 @@ void x86_core::init()
 
 void x86_core::set_current_tcb(const stacsos::kernel::sched::tcb *tcb)
 {
-	// TODO: Check if TCB is changing...
+	switch_fpu(get_current_tcb(), tcb);
 
 	// A pointer to the current TCB is held in the GS register.
 	gsbase::write((u64)tcb);
 
 	// Update the CR3
-	cr3::write(tcb->cr3);
+	switch_address_space(tcb);
 
 	// Update the TSS
 	tss_.set_kernel_stack(tcb->kernel_stack);
 }
 
+/**
+ * Loads the address space of the next task, avoiding TLB flushes wherever possible.  The low 12 bits of the task's CR3
+ * hold the identifier of its address space, which is used as the PCID when PCIDs are enabled.
+ */
+void x86_core::switch_address_space(const tcb *next)
+{
+	u64 next_cr3 = next->cr3;
+
+	// Tasks in the kernel's root address space (i.e. the idle task) never touch user memory, so they can borrow
+	// whatever address space is already loaded, unless it is about to be freed.
+	if (next_cr3 == kernel_cr3_ && !__atomic_exchange_n(&release_borrowed_cr3_, false, __ATOMIC_ACQUIRE)) {
+		return;
+	}
+
+	if (!pcid_enabled_) {
+		next_cr3 &= ~0xfffull;
+	}
+
+	if (next_cr3 == active_cr3_) {
+		return;
+	}
+
+	// Address spaces that have an identifier keep their TLB entries, so there is nothing to flush, unless the
+	// identifier has been recycled since this core last used it.  Untagged address spaces all share PCID zero, and
+	// so must be flushed when they are switched to.
+	u64 load_cr3 = next_cr3;
+
+	u16 asid = next_cr3 & 0xfff;
+	if (pcid_enabled_ && asid != 0) {
+		u32 generation = address_space::asid_generation(asid);
+
+		if (asid_generations_[asid] == generation) {
+			load_cr3 |= 1ull << 63;
+		} else {
+			asid_generations_[asid] = generation;
+		}
+	}
+
+	cr3::write(load_cr3);
+
+	// The previous address space is only let go of once it's no longer loaded.
+	__atomic_store_n(&active_cr3_, next_cr3, __ATOMIC_SEQ_CST);
+	reaper::get().resources_released();
+}
+
+/**
+ * The register state of the task that last used the extended registers is only ever compared against the task being
+ * switched to, so a terminated task can simply be dropped as the owner.
+ */
+void x86_core::forget_task(const tcb &t)
+{
+	tcb *owner = (tcb *)&t;
+	__atomic_compare_exchange_n(&fpu_owner_, &owner, nullptr, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+bool x86_core::release_address_space(u64 cr3)
+{
+	if ((__atomic_load_n(&active_cr3_, __ATOMIC_ACQUIRE) & ~0xfffull) != (cr3 & ~0xfffull)) {
+		return true;
+	}
+
+	// Only the idle task can still be using a dead address space, so rescheduling makes the core switch to the
+	// kernel's page tables (see switch_address_space).
+	__atomic_store_n(&release_borrowed_cr3_, true, __ATOMIC_RELEASE);
+	kick();
+
+	return false;
+}
+
 stacsos::kernel::sched::tcb *x86_core::get_current_tcb() { return (stacsos::kernel::sched::tcb *)gsbase::read(); }
 
 static void yield_handler(u8 irq_nr, void *mcontext, void *arg)
@@ -79,6 +169,142 @@ static void yield_handler(u8 irq_nr, void *mcontext, void *arg)
 	c->schedule();
 }
 
+static void reschedule_handler(u8 irq_nr, void *mcontext, void *arg)
+{
+	x86_core *c = (x86_core *)arg;
+	c->schedule();
+	c->lapic().eoi();
+}
+
+/*
+ * Called from x86_switch_to_next, on the blocking task's stack, once it has been saved.
+ */
+extern "C" void x86_switch_schedule(x86_core *core) { core->schedule(); }
+
+/*
+ * Called once a core has left the kernel stack of the task it switched away from, so the task can be picked up by
+ * another core, or freed if it has terminated.
+ */
+extern "C" void x86_release_task(tcb *prev)
+{
+	__atomic_store_n(&prev->running_on, nullptr, __ATOMIC_SEQ_CST);
+
+	if (prev->migrating) {
+		((thread *)prev->entity)->finish_migration();
+	}
+
+	reaper::get().resources_released();
+}
+
+void x86_core::switch_to_next() { x86_switch_to_next(this); }
+
+void x86_core::kick()
+{
+	auto &me = this_core();
+	if (&me == this) {
+		return;
+	}
+
+	// If the core is waiting in MWAIT, then the store to its monitored flag is enough to wake it up.
+	if (__atomic_exchange_n(&idle_polling_, false, __ATOMIC_SEQ_CST)) {
+		return;
+	}
+
+	me.lapic_.send_ipi(apic_id_, reschedule_irq);
+}
+
+/**
+ * Chooses how this core should idle.  MWAIT is preferred, so long as it can be woken by masked interrupts, but
+ * it is usually hidden from virtual machines, in which case HLT is used.  The "idle" option can be used to
+ * force a particular mode.
+ */
+void x86_core::select_idle_mode()
+{
+	const char *mode = config::get().get_option_or_default("idle", "auto");
+
+	if (memops::strcmp(mode, "poll") == 0) {
+		idle_mode_ = idle_mode::poll;
+		return;
+	}
+
+	idle_mode_ = idle_mode::hlt;
+
+	if (memops::strcmp(mode, "hlt") == 0) {
+		return;
+	}
+
+	u32 eax = 1, ebx = 0, ecx = 0, edx = 0;
+	__cpuid(eax, ebx, ecx, edx);
+
+	if (!(ecx & (1u << 3))) {
+		return;
+	}
+
+	// Leaf 5 describes MONITOR/MWAIT: ECX bit 0 says the extensions are enumerated, and bit 1 says that
+	// interrupts can be treated as break events even when they are masked.
+	eax = 5;
+	ebx = ecx = edx = 0;
+	__cpuid(eax, ebx, ecx, edx);
+
+	if ((ecx & 3) == 3) {
+		idle_mode_ = idle_mode::mwait;
+	}
+}
+
+void x86_core::idle()
+{
+	switch (idle_mode_) {
+	case idle_mode::poll:
+		if (resched_pending()) {
+			asm volatile("int $0xff");
+		} else {
+			__relax();
+		}
+		break;
+
+	case idle_mode::hlt:
+		// Work that arrives from another core comes with a kick, but work that arrives with an interrupt on this core
+		// (e.g. a thread woken up by the keyboard) only marks a reschedule as pending, as the interrupt is already
+		// running here.  So check for that with interrupts disabled, and then atomically re-enable them and halt
+		// (STI only takes effect after the next instruction), so that nothing can slip in between.
+		asm volatile("cli");
+
+		if (resched_pending()) {
+			asm volatile("sti; int $0xff");
+		} else {
+			asm volatile("sti; hlt");
+		}
+
+		break;
+
+	case idle_mode::mwait: {
+		// Interrupts stay disabled while the monitor is armed, so that this task can't be switched out with
+		// idle_polling_ still set (which would cause kicks to be lost).  MWAIT is still woken by a pending
+		// interrupt, because of the break-on-masked-interrupt extension (ECX=1).
+		asm volatile("cli");
+
+		__atomic_store_n(&idle_polling_, true, __ATOMIC_SEQ_CST);
+		asm volatile("monitor" ::"a"(&idle_polling_), "c"(0), "d"(0));
+
+		if (idle_polling_ && !resched_pending()) {
+			asm volatile("mwait" ::"a"(0), "c"(1));
+		}
+
+		// If someone else cleared the flag, then they kicked us, and skipped the IPI, so reschedule here.  Likewise if
+		// an interrupt on this core has left a reschedule pending (see the HLT case).
+		bool kicked = !__atomic_exchange_n(&idle_polling_, false, __ATOMIC_SEQ_CST) || resched_pending();
+
+		asm volatile("sti");
+
+		if (kicked) {
+			asm volatile("int $0xff");
+		}
+
+		break;
+	}
+	}
+}
+
 void x86_core::populate_dt()
 {
 	// Populate the GDT, with a NULL entry, then CODE and DATA segments for KERNEL and USER mode respectively.
@@ -100,41 +326,71 @@ void x86_core::populate_dt()
 	// The IRQ manager takes care of the IDT
 	irqs_.initialise();
 	irqs_.reserve_irq(0xff, yield_handler, this);
+	irqs_.reserve_irq(reschedule_irq, reschedule_handler, this);
 
 	// The TSS is needed for swapping stacks if we're going into USER mode.
 	tss_.set_kernel_stack(0);
+
+	// Overflowing a kernel stack faults on its guard page, but the fault can't be delivered on that same stack, and
+	// so escalates to a double fault.  Double faults therefore get a stack of their own.
+	auto &kstacks = memory_manager::get().kstackalloc();
+	tss_.set_interrupt_stack(double_fault_ist, (uintptr_t)kstacks.allocate() + kstacks.stack_size());
+	idt_.set_interrupt_stack(0x08, double_fault_ist);
+	idt_.reload();
+
 	tss_.reload(0x28);
 }
 
-bool x86_core::remote_run() { return false; }
+/*
+ * Application processor startup.  The trampoline code (in boot/mpstartup.S) is copied into low memory,
+ * along with a set of page tables that identity map low memory (so that the trampoline can survive
+ * turning on paging), and that also contain the kernel's mappings (so that it can then jump into the
+ * kernel proper).  Both of these live in the first 1MB of physical memory, which is never handed out
+ * by the page allocator.
+ */
+#define MPSTARTUP_BASE 0x8000
+#define MPSTARTUP_PML4 0x9000
+#define MPSTARTUP_PDP 0xa000
 
-#if 0
+// This must match the layout in boot/mpstartup.S
 struct mpstartup_data {
-	u64 mpready;
-	u64 mpcr3;
-	x86_core *core_obj;
-	void *mpstack;
-	void (stacsos::kernel::arch::x86::x86_core::*trampoline)(void);
+	u32 pml4;
+	u32 ready;
+	u64 cr3;
+	u64 stack;
+	x86_core *core;
 } __packed;
 
-extern "C" char _MPSTARTUP_START, _MPSTARTUP_END, _MPSTARTUP_SIZE;
-extern "C" mpstartup_data _MPSTARTUP_DATA;
+extern "C" char mpstartup_start, mpstartup_end, mpstartup_data_start;
+
+static volatile mpstartup_data *get_mpstartup_data()
+{
+	return (volatile mpstartup_data *)phys_to_virt(MPSTARTUP_BASE + (u64)(&mpstartup_data_start - &mpstartup_start));
+}
+
+// The stack an AP uses until it starts running its idle thread.
+static const int mpstartup_stack_order = 2;
 
 bool x86_core::remote_run()
 {
 	auto &me = this_core();
 
-	pfn_t mpstart_pfn = prepare_mpstartup_code();
+	u8 mpstart_pfn = prepare_mpstartup_code();
+
+	page *stack = memory_manager::get().pgalloc().allocate_pages(mpstartup_stack_order, page_allocation_flags::zero);
+	if (!stack) {
+		return false;
+	}
 
 	// Acquire a pointer to the mp startup data structure, which we need to fill in.  It should
-	// be volatile, so that we can check the mpready flag without worrying that the compiler
+	// be volatile, so that we can check the ready flag without worrying that the compiler
 	// optimises "redundant checks" away.
-	volatile mpstartup_data *d = (volatile mpstartup_data *)&_MPSTARTUP_DATA;
-	d->mpready = 0; // Is the core ready?
-	d->mpcr3 = __read_cr3(); // The pages tables to provide the core with (just the same as this core's)
-	d->core_obj = this; // A pointer to the core object that is coming online
-	d->mpstack = (void *)(((u64) new char[0x1000]) + 0x1000); // A temporary stack (which we need to remember to free at some point)
-	d->trampoline = &exegol::arch::x86::x86_core::complete_remote_init; // The function to call once we've gotten into 64-bit mode
+	volatile mpstartup_data *d = get_mpstartup_data();
+	d->pml4 = MPSTARTUP_PML4; // The page tables to use while coming up
+	d->ready = 0; // Is the core ready?
+	d->cr3 = memory_manager::get().root_address_space().pgtable().effective_cr3(); // The kernel's page tables
+	d->stack = (u64)stack->base_address_ptr() + (PAGE_SIZE << mpstartup_stack_order); // A temporary stack
+	d->core = this; // A pointer to the core object that is coming online
 
 	// Stick in a full memory fence, just to be safe.
 	asm volatile("mfence" ::: "memory");
@@ -142,53 +398,122 @@ bool x86_core::remote_run()
 	// The sequence is INIT --> SIPI (--> SIPI)
 
 	// Send the INIT
-	me.lapic_.send_remote_init(id());
+	me.lapic_.send_remote_init(apic_id_);
 	me.tsc_.spin(10); // Wait for 10ms...
 
 	// Send the SIPI
-	me.lapic_.send_remote_sipi(id(), mpstart_pfn);
+	me.lapic_.send_remote_sipi(apic_id_, mpstart_pfn);
 	me.tsc_.spin(1); // Wait for 1ms...
 
-	// If the core didn't come online, send another SIPI and give it a second
-	if (!d->mpready) {
-		me.lapic_.send_remote_sipi(id(), mpstart_pfn);
-		me.tsc_.spin(1000); // 1s
+	// If the core didn't come online, send another SIPI.  If the core did in fact start, but just hasn't
+	// finished initialising yet, then it will ignore this.
+	if (!d->ready) {
+		me.lapic_.send_remote_sipi(apic_id_, mpstart_pfn);
+	}
+
+	// Give the core a second to finish initialising itself.  Cores are brought up one at a time, so the
+	// trampoline data (and the PIT, for timer calibration) is not shared.
+	for (int i = 0; i < 1000 && !d->ready; i++) {
+		me.tsc_.spin(1);
 	}
 
 	// Return whether or not the core came online.
-	return !!d->mpready;
+	return !!d->ready;
 }
 
-pfn_t x86_core::prepare_mpstartup_code()
+u8 x86_core::prepare_mpstartup_code()
 {
-	// This function is a total hack.  It just brutally copies the mp startup code and data into an arbitrary page,
-	// because we can only access PFNs < 0x100 when initialising other processors.
+	// Copy the trampoline into low memory.  It's written to run at MPSTARTUP_BASE.
+	memops::memcpy(phys_to_virt(MPSTARTUP_BASE), &mpstartup_start, (size_t)(&mpstartup_end - &mpstartup_start));
+
+	// The trampoline page tables are a copy of the kernel's top-level page table, with the first
+	// 1G of physical memory identity mapped at address zero.
+	u64 *pml4 = (u64 *)phys_to_virt(MPSTARTUP_PML4);
+	u64 *pdp = (u64 *)phys_to_virt(MPSTARTUP_PDP);
 
-	pfn_t target_pfn = 0; // Let's go for page 0.  The mp startup assembly is written to
-						  // work in page 0 -- there is one place where a relative address
-						  // computation is made, which assumes we're running in page zero.
+	memops::memcpy(pml4, phys_to_virt(memory_manager::get().root_address_space().pgtable().effective_cr3()), PAGE_SIZE);
+	memops::bzero(pdp, PAGE_SIZE);
 
-	// Copy the mp startup assembly into the right place.  Technically, we only need the 16-bit
-	// code, because once we jump into 32-bit mode, we're actually executing at normal addresses.
-	void *target_addr = (void *)(target_pfn << PAGE_BITS);
-	memops::memcpy(target_addr, (void *)&_MPSTARTUP_START, (size_t)&_MPSTARTUP_SIZE);
+	pml4[0] = MPSTARTUP_PDP | 3; // PRESENT | WRITABLE
+	pdp[0] = 0x83; // 1G mapping: 0 -> 0
 
-	// We really need to remember to unmap page zero later...
-	return target_pfn;
+	return MPSTARTUP_BASE >> PAGE_BITS;
 }
 
 void x86_core::complete_remote_init()
 {
-	// Update the TSC aux MSR with the core ID, so that the rdpid instruction works.
-	msr::write(msr_indicies::IA32_TSC_AUX, id());
+	// Update the TSC aux MSR with the core ID, so that this_core_id() works.
+	msrs::ia32_tsc_aux = id();
 
-	dprintf("core [%d] online\n", id());
-
-	// Initialise and run this new core.
+	// Initialise this new core.
 	init();
+
+	dprintf("core [%d]: online\n", id());
+
+	// Let the bootstrap core know that we're up, then start running.
+	get_mpstartup_data()->ready = 1;
 	run();
 }
-#endif
+
+extern "C" __noreturn void x86_start_secondary(x86_core *core) { core->complete_remote_init(); }
+
+/**
+ * Switches the extended register state lazily.  If the previous task used the registers while it
+ * was running (i.e. CR0.TS is clear), its state is saved.  The next task's state is only loaded when
+ * it first uses the registers: unless its state is still loaded on this core, CR0.TS is set, so that
+ * this raises a device-not-available fault (see handle_fpu_trap).
+ */
+void x86_core::switch_fpu(tcb *prev, const tcb *next)
+{
+	if (prev == next) {
+		return;
+	}
+
+	if (prev && prev == fpu_owner_ && !fpu::task_switched()) {
+		fpu::save(prev->fpu_state);
+	}
+
+	if (next == fpu_owner_ && next->fpu_core == id()) {
+		fpu::clear_task_switched();
+	} else {
+		fpu::set_task_switched();
+	}
+}
+
+/**
+ * Handles the device-not-available fault, raised when the current task first uses the extended
+ * registers after being switched in.  The registers always hold the saved state of the previous
+ * owner at this point, so only the current task's state needs to be loaded.
+ */
+void x86_core::handle_fpu_trap()
+{
+	tcb *current = get_current_tcb();
+
+	fpu::clear_task_switched();
+
+	if (!current->fpu_state) {
+		current->fpu_state = fpu::alloc_state();
+	}
+
+	fpu::restore(current->fpu_state);
+
+	current->fpu_core = id();
+	fpu_owner_ = current;
+}
+
+void x86_core::handle_double_fault(machine_context *mc)
+{
+	u64 fault_address = cr2::read();
+
+	dprintf("CORE %d - DOUBLE FAULT\n", id());
+	mc->dump();
+
+	if (memory_manager::get().kstackalloc().is_guard_page(fault_address)) {
+		panic("Kernel stack overflow (%lx)", fault_address);
+	}
+
+	panic("Double Fault");
+}
 
 void x86_core::handle_gpf(machine_context *mc)
 {
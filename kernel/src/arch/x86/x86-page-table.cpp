@@ -42,6 +42,56 @@ x86_page_table *x86_page_table::create_linked_copy(page_table_allocator &pta)
 	return (x86_page_table *)new_pml4_entries;
 }
 
+void x86_page_table::destroy_linked_copy(page_table_allocator &pta)
+{
+	for (int i = 0; i < 0x100; i++) {
+		if (!pml4_[i].present()) {
+			continue;
+		}
+
+		page &pdpt_page = page::get_from_base_address(pml4_[i].base_address());
+		pdp &pdpt = *(pdp *)pdpt_page.base_address_ptr();
+
+		for (int j = 0; j < 0x200; j++) {
+			if (!pdpt[j].present() || pdpt[j].size()) {
+				continue;
+			}
+
+			page &pdt_page = page::get_from_base_address(pdpt[j].base_address());
+			pd &pdt = *(pd *)pdt_page.base_address_ptr();
+
+			for (int k = 0; k < 0x200; k++) {
+				if (!pdt[k].present() || pdt[k].size()) {
+					continue;
+				}
+
+				pta.free(&page::get_from_base_address(pdt[k].base_address()));
+			}
+
+			pta.free(&pdt_page);
+		}
+
+		pta.free(&pdpt_page);
+	}
+
+	pta.free(&page::get_from_base_address(effective_cr3()));
+}
+
+void x86_page_table::prepare_top_level(page_table_allocator &pta, u64 virtual_address)
+{
+	pml4e &l4 = pml4_[pml4_index(virtual_address)];
+	if (l4.present()) {
+		return;
+	}
+
+	l4.reset();
+
+	page *l3page = pta.allocate();
+	l4.base_address(l3page->base_address());
+	l4.present(true);
+	l4.rw(true);
+}
+
 void x86_page_table::map(page_table_allocator &pta, u64 virtual_address, u64 physical_address, mapping_flags flags, mapping_size size)
 {
 	// TODO: assert VA canonical
@@ -53,3 +53,24 @@ void config::add_option(const char *key, const char *value)
 	options_[nr_options_].value = value;
 	nr_options_++;
 }
+
+u64 config::get_option_u64_or_default(const char *name, u64 dfl) const
+{
+	const char *v = get_option(name);
+	if (!v || !*v) {
+		return dfl;
+	}
+
+	u64 value = 0;
+	while (*v) {
+		if (*v < '0' || *v > '9') {
+			dprintf("config: invalid value for option '%s'\n", name);
+			return dfl;
+		}
+
+		value = (value * 10) + (*v - '0');
+		v++;
+	}
+
+	return value;
+}
@@ -148,9 +148,11 @@ void virtual_console::on_key_down(keys key)
 		return;
 	}
 
+	unique_irq_lock l(read_waiters_.lock());
+
 	read_buffer_[read_buffer_tail_++] = ch;
 	read_buffer_tail_ %= ARRAY_SIZE(read_buffer_);
-	read_buffer_event_.trigger();
+	read_waiters_.wake_n_locked(1);
 }
 
 static u32 vga_colour_map[] = {
@@ -327,18 +329,47 @@ void virtual_console::update_cursor()
 
 u8 virtual_console::read_char()
 {
-	while (read_buffer_head_ == read_buffer_tail_) {
-		read_buffer_event_.wait();
-	}
+	u8 elem = 0;
+
+	// The character is taken in the condition, i.e. under the lock, so that another reader can't take
+	// it first.
+	read_waiters_.wait_until([this, &elem] {
+		if (read_buffer_head_ == read_buffer_tail_) {
+			return false;
+		}
 
-	u8 elem = read_buffer_[read_buffer_head_];
+		elem = read_buffer_[read_buffer_head_];
 
-	read_buffer_head_++;
-	read_buffer_head_ %= ARRAY_SIZE(read_buffer_);
+		read_buffer_head_++;
+		read_buffer_head_ %= ARRAY_SIZE(read_buffer_);
+
+		return true;
+	});
 
 	return elem;
 }
 
+/**
+ * Takes up to length characters that have already been typed, without blocking, and returns the number
+ * taken.
+ */
+size_t virtual_console::try_read(void *buffer, size_t length)
+{
+	u8 *cur = (u8 *)buffer;
+	size_t n = 0;
+
+	unique_irq_lock l(read_waiters_.lock());
+
+	while (n < length && read_buffer_head_ != read_buffer_tail_) {
+		cur[n++] = read_buffer_[read_buffer_head_];
+
+		read_buffer_head_++;
+		read_buffer_head_ %= ARRAY_SIZE(read_buffer_);
+	}
+
+	return n;
+}
+
 namespace stacsos::kernel::dev::console {
 
 class virtual_console_file : public file {
@@ -0,0 +1,132 @@
+/* SPDX-License-Identifier: MIT */
+
+/* StACSOS - Kernel
+ *
+ * Copyright (c) University of St Andrews 2024
+ * Tom Spink <tcs6@st-andrews.ac.uk>
+ */
+#include <stacsos/kernel/arch/core-manager.h>
+#include <stacsos/kernel/arch/core.h>
+#include <stacsos/kernel/dev/misc/sched-control.h>
+#include <stacsos/kernel/fs/file.h>
+#include <stacsos/memops.h>
+#include <stacsos/printf.h>
+#include <stacsos/string.h>
+
+using namespace stacsos;
+using namespace stacsos::kernel::arch;
+using namespace stacsos::kernel::fs;
+using namespace stacsos::kernel::dev;
+using namespace stacsos::kernel::dev::misc;
+
+device_class sched_control::sched_control_device_class(device_class::root, "schedctl");
+
+/*
+ * Carries out a command written to the device, i.e. "<algorithm>" or "<core> <algorithm>".  Returns
+ * false if the command is malformed, or names an unknown core or algorithm.
+ */
+static bool run_command(char *command)
+{
+	int core_id = -1;
+
+	if (*command >= '0' && *command <= '9') {
+		core_id = 0;
+		while (*command >= '0' && *command <= '9') {
+			core_id = (core_id * 10) + (*command++ - '0');
+		}
+
+		if (*command != ' ') {
+			return false;
+		}
+
+		while (*command == ' ') {
+			command++;
+		}
+	}
+
+	if (core_id < 0) {
+		// Check the name first, so that a bad name doesn't leave the cores half switched over.
+		auto *probe = core::create_fair_algorithm(command);
+		if (!probe) {
+			return false;
+		}
+
+		delete probe;
+
+		for (auto *c : core_manager::get().cores()) {
+			c->set_fair_algorithm(command);
+		}
+
+		return true;
+	}
+
+	for (auto *c : core_manager::get().cores()) {
+		if (c->id() == core_id) {
+			return c->set_fair_algorithm(command);
+		}
+	}
+
+	return false;
+}
+
+/*
+ * A snapshot of the algorithm in use on each core, which is read back as text.  Writes are commands.
+ */
+class sched_control_file : public file {
+public:
+	sched_control_file(string &&report)
+		: file(report.length())
+		, report_(move(report))
+	{
+	}
+
+	virtual size_t pread(void *buffer, size_t offset, size_t length) override
+	{
+		if (offset >= report_.length()) {
+			return 0;
+		}
+
+		if (offset + length > report_.length()) {
+			length = report_.length() - offset;
+		}
+
+		memops::memcpy(buffer, report_.c_str() + offset, length);
+		return length;
+	}
+
+	virtual size_t pwrite(const void *buffer, size_t offset, size_t length) override
+	{
+		char command[32];
+
+		if (length == 0 || length >= sizeof(command)) {
+			return 0;
+		}
+
+		memops::memcpy(command, buffer, length);
+
+		// Ignore any trailing newline, or other whitespace.
+		while (length > 0 && (command[length - 1] == '\n' || command[length - 1] == ' ' || command[length - 1] == 0)) {
+			length--;
+		}
+
+		command[length] = 0;
+
+		return run_command(command) ? length : 0;
+	}
+
+private:
+	string report_;
+};
+
+shared_ptr<file> sched_control::open_as_file()
+{
+	string report;
+
+	for (auto *c : core_manager::get().cores()) {
+		char line[64];
+		snprintf(line, sizeof(line), "core%d %s\n", c->id(), c->sched_alg_name());
+		report += string(line);
+	}
+
+	return shared_ptr(new sched_control_file(move(report)));
+}
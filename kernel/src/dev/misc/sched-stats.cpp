@@ -0,0 +1,118 @@
+/* SPDX-License-Identifier: MIT */
+
+/* StACSOS - Kernel
+ *
+ * Copyright (c) University of St Andrews 2024
+ * Tom Spink <tcs6@st-andrews.ac.uk>
+ */
+#include <stacsos/kernel/arch/core-manager.h>
+#include <stacsos/kernel/arch/core.h>
+#include <stacsos/kernel/dev/misc/sched-stats.h>
+#include <stacsos/kernel/fs/file.h>
+#include <stacsos/kernel/sched/process-manager.h>
+#include <stacsos/kernel/sched/process.h>
+#include <stacsos/kernel/sched/thread.h>
+#include <stacsos/memops.h>
+#include <stacsos/printf.h>
+#include <stacsos/string.h>
+
+using namespace stacsos;
+using namespace stacsos::kernel::arch;
+using namespace stacsos::kernel::fs;
+using namespace stacsos::kernel::dev;
+using namespace stacsos::kernel::dev::misc;
+using namespace stacsos::kernel::sched;
+
+device_class sched_stats::sched_stats_device_class(device_class::root, "schedstat");
+
+/*
+ * Appends one line to the report, containing the name of the histogram, followed by the count in
+ * each bucket.
+ */
+static void append_histogram(string &report, const char *name, const latency_histogram &h)
+{
+	char line[32];
+
+	report += string(name);
+	for (int i = 0; i < latency_histogram::nr_buckets; i++) {
+		snprintf(line, sizeof(line), " %lu", h.buckets[i]);
+		report += string(line);
+	}
+
+	report += '\n';
+}
+
+/*
+ * A snapshot of the scheduler statistics, which is read back as text.
+ */
+class sched_stats_file : public file {
+public:
+	sched_stats_file(string &&report)
+		: file(report.length())
+		, report_(move(report))
+	{
+	}
+
+	virtual size_t pread(void *buffer, size_t offset, size_t length) override
+	{
+		if (offset >= report_.length()) {
+			return 0;
+		}
+
+		if (offset + length > report_.length()) {
+			length = report_.length() - offset;
+		}
+
+		memops::memcpy(buffer, report_.c_str() + offset, length);
+		return length;
+	}
+
+	// No writing allowed!
+	virtual size_t pwrite(const void *buffer, size_t offset, size_t length) override { return 0; }
+
+private:
+	string report_;
+};
+
+shared_ptr<file> sched_stats::open_as_file()
+{
+	char name[32];
+
+	// Bucket i counts wakeup-to-run latencies in [2^i, 2^(i+1)) nanoseconds.
+	string report = "# wakeup latency histograms: name, then counts for log2(ns) buckets 0-31\n";
+
+	for (auto *c : core_manager::get().cores()) {
+		snprintf(name, sizeof(name), "core%d", c->id());
+		append_histogram(report, name, c->wakeup_latency());
+	}
+
+	// Threads are named after their position in the process and thread lists, so the names of threads may change
+	// as processes exit.  Both lists are snapshots, taken under their locks, which also keep the processes and threads
+	// alive while the report is built.
+	int pid = 0;
+	list<shared_ptr<process>> processes = process_manager::get().processes();
+
+	for (const auto &p : processes) {
+		list<shared_ptr<thread>> threads = p->threads();
+
+		int tid = 0;
+		for (const auto &t : threads) {
+			snprintf(name, sizeof(name), "thread%d.%d", pid, tid++);
+			append_histogram(report, name, t->wakeup_latency());
+		}
+
+		pid++;
+	}
+
+	report += "# run queue lock contention: name, acquisitions, contended acquisitions\n";
+
+	for (auto *c : core_manager::get().cores()) {
+		spinlock_stats s = c->runqueue_lock_stats();
+
+		char line[80];
+		snprintf(line, sizeof(line), "core%d.rqlock %lu %lu\n", c->id(), s.acquisitions, s.contentions);
+		report += string(line);
+	}
+
+	return shared_ptr(new sched_stats_file(move(report)));
+}
@@ -112,10 +112,16 @@ void ahci_storage_device::submit_real_io_request(block_io_request &request)
 	}
 }
 
+// Each command table has room for eight PRDT entries (see ahci_controller), each of which can describe up to 4M.
+static const int max_prdt_entries = 8;
+static const u64 max_prdt_entry_size = 1 << 22;
+
 void ahci_storage_device::do_read_block_sync(void *buffer, u64 start, u64 count)
 {
 	// dprintf("ahci: read into %p %lu %lu\n", buffer, start, count);
 
+	sched::unique_mutex_lock l(command_lock_);
+
 	int slot_index;
 	volatile hba_cmd_header *cmd = get_free_cmd_slot(slot_index);
 	if (cmd == nullptr) {
@@ -124,37 +130,47 @@ void ahci_storage_device::do_read_block_sync(void *buffer, u64 start, u64 count)
 
 	cmd->cfl = sizeof(fis_reg_host2device) / sizeof(u32);
 	cmd->w = 0;
-	cmd->prdtl = (u16)((count - 1) >> 4) + 1;
 	cmd->p = 0;
 
-	if (cmd->prdtl > 8) {
-		panic("too many prdtls");
-	}
-
 	// Prepare buffers
 	volatile hba_cmd_table *cmdtbl = (hba_cmd_table *)phys_to_virt((u64)cmd->ctba);
-	memops::bzero((void *)cmdtbl, sizeof(hba_cmd_table) + sizeof(hba_prdt_entry) * cmd->prdtl);
-
-	auto buffer_mapping = page_table::current()->get_mapping((u64)buffer);
-	if (buffer_mapping.result == mapping_result::unmapped) {
-		panic("destination buffer not mapped");
-	}
+	memops::bzero((void *)cmdtbl, sizeof(hba_cmd_table) + sizeof(hba_prdt_entry) * max_prdt_entries);
+
+	// The buffer is only virtually contiguous (e.g. it may be on a kernel stack), so it's described to the controller
+	// a page at a time, merging pages that happen to be physically contiguous.
+	u64 remaining = count << 9;
+	u64 buffer_chunk = (u64)buffer;
+	int nr_prdt_entries = 0;
+
+	while (remaining > 0) {
+		auto buffer_mapping = page_table::current()->get_mapping(buffer_chunk);
+		if (buffer_mapping.result == mapping_result::unmapped) {
+			panic("destination buffer not mapped");
+		}
 
-	u64 buffer_chunk = buffer_mapping.address;
-	for (int prdt_idx = 0; prdt_idx < cmd->prdtl - 1; prdt_idx++) {
-		cmdtbl->prdt_entry[prdt_idx].dba = (u32)buffer_chunk;
-		cmdtbl->prdt_entry[prdt_idx].dbau = (u32)((u64)buffer_chunk >> 32);
-		cmdtbl->prdt_entry[prdt_idx].dbc = (8 * 1024) - 1;
-		cmdtbl->prdt_entry[prdt_idx].i = 1;
+		u64 chunk_size = min(remaining, PAGE_SIZE - (buffer_chunk & (PAGE_SIZE - 1)));
+
+		volatile hba_prdt_entry *prev = nr_prdt_entries > 0 ? &cmdtbl->prdt_entry[nr_prdt_entries - 1] : nullptr;
+		if (prev && (((u64)prev->dbau << 32) | prev->dba) + prev->dbc + 1 == buffer_mapping.address
+			&& prev->dbc + chunk_size < max_prdt_entry_size) {
+			prev->dbc = prev->dbc + chunk_size;
+		} else {
+			if (nr_prdt_entries == max_prdt_entries) {
+				panic("too many prdtls");
+			}
+
+			volatile hba_prdt_entry *entry = &cmdtbl->prdt_entry[nr_prdt_entries++];
+			entry->dba = (u32)buffer_mapping.address;
+			entry->dbau = (u32)(buffer_mapping.address >> 32);
+			entry->dbc = chunk_size - 1;
+		}
 
-		buffer_chunk += 8 * 1024;
-		count -= 16;
+		buffer_chunk += chunk_size;
+		remaining -= chunk_size;
 	}
 
-	cmdtbl->prdt_entry[cmd->prdtl - 1].dba = (u32)buffer_chunk;
-	cmdtbl->prdt_entry[cmd->prdtl - 1].dbau = (u32)((u64)buffer_chunk >> 32);
-	cmdtbl->prdt_entry[cmd->prdtl - 1].dbc = (count << 9) - 1;
-	cmdtbl->prdt_entry[cmd->prdtl - 1].i = 1;
+	cmdtbl->prdt_entry[nr_prdt_entries - 1].i = 1;
+	cmd->prdtl = (u16)nr_prdt_entries;
 
 	// Prepare command
 	volatile fis_reg_host2device *cmdfis = (fis_reg_host2device *)(&cmdtbl->cfis);
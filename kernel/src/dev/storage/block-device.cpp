@@ -7,7 +7,7 @@
  */
 #include <stacsos/kernel/debug.h>
 #include <stacsos/kernel/dev/storage/block-device.h>
-#include <stacsos/kernel/sched/event.h>
+#include <stacsos/kernel/sched/wait-queue.h>
 
 using namespace stacsos::kernel;
 using namespace stacsos::kernel::dev;
@@ -26,10 +26,21 @@ void block_device::write_blocks_sync(const void *buffer, u64 start, u64 count)
 }
 
 struct sync_state {
-	manual_reset_event e;
+	wait_queue waiter;
+	bool complete;
 };
 
-static void request_cb(block_io_request *request, void *state) { ((sync_state *)state)->e.trigger(); }
+static void request_cb(block_io_request *request, void *state)
+{
+	sync_state *ss = (sync_state *)state;
+
+	// The sync state lives on the waiter's stack, so it must be completed under the lock, otherwise the
+	// waiter could see the completion, and return, before we've finished with it.
+	unique_irq_lock l(ss->waiter.lock());
+
+	ss->complete = true;
+	ss->waiter.wake_n_locked(1);
+}
 
 void block_device::submit_sync_request(block_io_request_direction direction, void *buffer, u64 start, u64 count)
 {
@@ -42,9 +53,10 @@ void block_device::submit_sync_request(block_io_request_direction direction, voi
 	io_req.callback = request_cb;
 
 	sync_state state;
+	state.complete = false;
 	io_req.cb_state = &state;
 
 	submit_io_request(io_req);
 
-	state.e.wait();
+	state.waiter.wait_until([&state] { return state.complete; });
 }
@@ -64,6 +64,8 @@ void terminal::read(void *raw_buffer, size_t size)
 	}
 }
 
+size_t terminal::try_read(void *buffer, size_t size) { return attached_vc_->try_read(buffer, size); }
+
 void terminal::clear() { attached_vc_->clear(); }
 
 class terminal_file : public file {
@@ -80,6 +82,12 @@ public:
 		return length;
 	}
 
+	virtual bool try_read(void *buffer, size_t length, size_t &bytes_read) override
+	{
+		bytes_read = t_.try_read(buffer, length);
+		return bytes_read > 0 || length == 0;
+	}
+
 	virtual size_t pwrite(const void *buffer, size_t offset, size_t length) override
 	{
 		t_.write(buffer, length);
@@ -142,7 +142,10 @@ u64 fat_filesystem::next_cluster(u64 this_cluster)
 fs_node *fat_node::mkdir(const char *name)
 {
 	auto new_dir = new fat_node(fs(), this, fs_node_kind::directory, string(name), 0, 0, 0);
+
+	children_lock_.down_write();
 	children_.append(new_dir);
+	children_lock_.up_write();
 
 	return new_dir;
 }
@@ -151,18 +154,31 @@ fs_node *fat_node::resolve_child(const string &name)
 {
 	load();
 
+	children_lock_.down_read();
+
+	fs_node *found = nullptr;
 	for (auto child : children_) {
 		if (child->name() == name) {
-			return child;
+			found = child;
+			break;
 		}
 	}
 
-	return nullptr;
+	children_lock_.up_read();
+	return found;
 }
 
 void fat_node::load()
 {
+    if (__atomic_load_n(&loaded_, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+
+    // Another thread may have loaded the directory while we were waiting for the lock.
+    children_lock_.down_write();
+
     if (loaded_) {
+        children_lock_.up_write();
         return;
     }
 
@@ -279,7 +295,8 @@ void fat_node::load()
     }
     while (this_cluster < 0xFFF8);
 
-    loaded_ = true;
+    __atomic_store_n(&loaded_, true, __ATOMIC_RELEASE);
+    children_lock_.up_write();
 }
 
 
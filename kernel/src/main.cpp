@@ -16,6 +16,8 @@
 #include <stacsos/kernel/dev/gfx/qemu-stdvga.h>
 #include <stacsos/kernel/dev/input/keyboard.h>
 #include <stacsos/kernel/dev/misc/cmos-rtc.h>
+#include <stacsos/kernel/dev/misc/sched-control.h>
+#include <stacsos/kernel/dev/misc/sched-stats.h>
 #include <stacsos/kernel/dev/storage/ahci-storage-device.h>
 #include <stacsos/kernel/dev/storage/partitioned-device.h>
 #include <stacsos/kernel/dev/tty/terminal.h>
@@ -24,6 +26,7 @@
 #include <stacsos/kernel/log.h>
 #include <stacsos/kernel/mem/memory-manager.h>
 #include <stacsos/kernel/sched/process-manager.h>
+#include <stacsos/kernel/sched/reaper.h>
 #include <stacsos/memops.h>
 
 using namespace stacsos::kernel;
@@ -46,6 +49,12 @@ static void init_console()
 	auto rtc = new cmos_rtc(dm.sysbus());
 	dm.register_device(*rtc);
 
+	auto stats = new sched_stats(dm.sysbus());
+	dm.register_device(*stats);
+
+	auto sched_ctl = new sched_control(dm.sysbus());
+	dm.register_device(*sched_ctl);
+
 	auto kbd = new keyboard(dm.sysbus());
 	dm.register_device(*kbd);
 
@@ -156,6 +165,9 @@ __noreturn void main(const char *cmdline)
 	auto kp = stacsos::kernel::sched::process_manager::get().create_kernel_process(continue_main);
 	kp->start();
 
+	// Start the reaper, which frees the resources of threads and processes once they have terminated.
+	stacsos::kernel::sched::reaper::get().init();
+
 	main_logger.log(log_level::info, "continuing in kernel process");
 
 	// Tell the core manager to begin executing processes.
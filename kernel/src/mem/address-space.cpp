@@ -5,25 +5,90 @@
  * Copyright (c) University of St Andrews 2024
  * Tom Spink <tcs6@st-andrews.ac.uk>
  */
+#include <stacsos/kernel/lock.h>
 #include <stacsos/kernel/mem/address-space-region.h>
 #include <stacsos/kernel/mem/address-space.h>
 #include <stacsos/kernel/mem/memory-manager.h>
 #include <stacsos/kernel/mem/page-table-allocator.h>
 #include <stacsos/kernel/mem/page-table.h>
 
+using namespace stacsos::kernel;
 using namespace stacsos::kernel::mem;
 
+// Identifiers are handed out in order, and then recycled once their address spaces have been freed.  Once they have
+// all been used, new address spaces are left untagged, and pay for a full flush each time they are switched to.
+static spinlock_irq asid_lock;
+static u16 next_asid = 1;
+static u16 free_asids[address_space::max_asid];
+static u32 nr_free_asids = 0;
+
+u32 address_space::asid_generations_[address_space::max_asid + 1];
+
+u16 address_space::allocate_asid()
+{
+	unique_irq_lock l(asid_lock);
+
+	if (nr_free_asids > 0) {
+		return free_asids[--nr_free_asids];
+	}
+
+	if (next_asid <= max_asid) {
+		return next_asid++;
+	}
+
+	return 0;
+}
+
+void address_space::free_asid(u16 asid)
+{
+	if (asid == 0) {
+		return;
+	}
+
+	unique_irq_lock l(asid_lock);
+
+	// Cores may still be holding translations tagged with this identifier.  Moving its generation on makes each
+	// core flush them the next time it activates the identifier.
+	__atomic_add_fetch(&asid_generations_[asid], 1, __ATOMIC_RELAXED);
+	free_asids[nr_free_asids++] = asid;
+}
+
 address_space *address_space::create_linked(u64 alloc_rgn_start)
 {
 	auto linked_pt = pt_->create_linked_copy(pta_);
-	return new address_space(pta_, linked_pt, alloc_rgn_start);
+	return new address_space(pta_, linked_pt, alloc_rgn_start, allocate_asid());
+}
+
+/**
+ * Frees the memory backing this address space's regions, and its page tables.  Only linked address spaces (i.e. those
+ * of processes) can be freed, and only once no core has them loaded.
+ */
+address_space::~address_space()
+{
+	for (address_space_region *rgn : regions_) {
+		if (rgn->storage) {
+			u64 pages = (rgn->size + (PAGE_SIZE - 1)) / PAGE_SIZE;
+			memory_manager::get().pgalloc().free_pages(*rgn->storage, log2_ceil(pages));
+		}
+
+		delete rgn;
+	}
+
+	pt_->destroy_linked_copy(pta_);
+	free_asid(asid_);
 }
 
 address_space_region *address_space::alloc_region(u64 size, region_flags flags, bool allocate)
 {
 	u64 aligned_size = PAGE_ALIGN_UP(size);
-	u64 base = next_alloc_rgn_;
-	next_alloc_rgn_ += aligned_size;
+
+	u64 base;
+	{
+		unique_irq_lock l(lock_);
+
+		base = next_alloc_rgn_;
+		next_alloc_rgn_ += aligned_size;
+	}
 
 	return add_region(base, size, flags, allocate);
 }
@@ -37,10 +102,12 @@ address_space_region *address_space::add_region(u64 base, u64 size, region_flags
 
 	//dprintf("as: add-region base=%lx size=%lx flags=%d alloc=%d\n", base, size, flags, allocate);
 
-	if (allocate) {
-		u64 pages = (size + (PAGE_SIZE - 1)) / PAGE_SIZE;
-		rgn->storage = memory_manager::get().pgalloc().allocate_pages(log2_ceil(pages), page_allocation_flags::zero);
+	u64 pages = (size + (PAGE_SIZE - 1)) / PAGE_SIZE;
+	rgn->storage = allocate ? memory_manager::get().pgalloc().allocate_pages(log2_ceil(pages), page_allocation_flags::zero) : nullptr;
+
+	unique_irq_lock l(lock_);
 
+	if (allocate) {
 		u64 cur_virt = base;
 		u64 cur_phys = rgn->storage->base_address();
 
@@ -50,8 +117,6 @@ address_space_region *address_space::add_region(u64 base, u64 size, region_flags
 			cur_virt += PAGE_SIZE;
 			cur_phys += PAGE_SIZE;
 		}
-	} else {
-		rgn->storage = nullptr;
 	}
 
 	regions_.append(rgn);
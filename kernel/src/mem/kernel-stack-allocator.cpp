@@ -0,0 +1,130 @@
+/* SPDX-License-Identifier: MIT */
+
+/* StACSOS - Kernel
+ *
+ * Copyright (c) University of St Andrews 2024
+ * Tom Spink <tcs6@st-andrews.ac.uk>
+ */
+#include <stacsos/kernel/arch/core.h>
+#include <stacsos/kernel/config.h>
+#include <stacsos/kernel/debug.h>
+#include <stacsos/kernel/mem/kernel-stack-allocator.h>
+#include <stacsos/kernel/mem/memory-manager.h>
+#include <stacsos/kernel/mem/page-table.h>
+#include <stacsos/kernel/mem/page.h>
+
+using namespace stacsos::kernel;
+using namespace stacsos::kernel::mem;
+using namespace stacsos::kernel::arch;
+
+#define KSTACK_AREA 0xfffff80000000000
+
+kernel_stack_allocator::kernel_stack_allocator()
+	: area_base_(KSTACK_AREA)
+	, area_size_(GB(64))
+	, stack_pages_(0)
+	, next_slot_(0)
+	, free_stacks_(nullptr)
+{
+}
+
+void kernel_stack_allocator::init()
+{
+	// The stack size can be chosen with the "kstack_pages" option, and defaults to 64K.
+	stack_pages_ = config::get().get_option_u64_or_default("kstack_pages", 16);
+	if (stack_pages_ < 2 || stack_pages_ > 256) {
+		panic("invalid kernel stack size: %lu pages", stack_pages_);
+	}
+
+	dprintf("mem: kernel stacks are %lu pages\n", stack_pages_);
+
+	// Stacks are mapped into the root address space after processes have been created, which only works if the
+	// top-level entry covering them is already there to be copied into each process's page tables.
+	memory_manager::get().root_address_space().pgtable().prepare_top_level(memory_manager::get().ptalloc(), area_base_);
+}
+
+/**
+ * Returns the lowest address of a kernel stack.  The stack's contents are undefined.
+ */
+void *kernel_stack_allocator::allocate()
+{
+	auto &cache = caches_[core::this_core_id()];
+
+	{
+		unique_irq_lock l(cache.lock);
+
+		if (cache.count > 0) {
+			return cache.stacks[--cache.count];
+		}
+	}
+
+	unique_irq_lock l(lock_);
+
+	if (free_stacks_) {
+		void *stack = free_stacks_;
+		free_stacks_ = *(void **)stack;
+
+		return stack;
+	}
+
+	if ((next_slot_ + 1) * slot_size() > area_size_) {
+		panic("out of kernel stacks");
+	}
+
+	return map_slot(next_slot_++);
+}
+
+void kernel_stack_allocator::free(void *stack)
+{
+	auto &cache = caches_[core::this_core_id()];
+
+	{
+		unique_irq_lock l(cache.lock);
+
+		if (cache.count < cache_size) {
+			cache.stacks[cache.count++] = stack;
+			return;
+		}
+	}
+
+	unique_irq_lock l(lock_);
+
+	*(void **)stack = free_stacks_;
+	free_stacks_ = stack;
+}
+
+/**
+ * Backs a new slot with memory.  The first page of the slot is the guard page, and is left unmapped.  This must be
+ * called with the lock held, as it updates the shared page tables.
+ */
+void *kernel_stack_allocator::map_slot(u64 slot)
+{
+	auto &mm = memory_manager::get();
+	auto &pt = mm.root_address_space().pgtable();
+
+	u64 stack = area_base_ + (slot * slot_size()) + PAGE_SIZE;
+
+	for (u64 i = 0; i < stack_pages_; i++) {
+		page *pg = mm.pgalloc().allocate_pages(0);
+		if (!pg) {
+			panic("unable to allocate kernel stack");
+		}
+
+		pt.map(mm.ptalloc(), stack + (i << PAGE_BITS), pg->base_address(), mapping_flags::present | mapping_flags::writable);
+	}
+
+	return (void *)stack;
+}
+
+/**
+ * Returns true if the given address is in the guard page of a kernel stack, i.e. if accessing it means that the stack
+ * has overflowed.
+ */
+bool kernel_stack_allocator::is_guard_page(u64 address) const
+{
+	if (address < area_base_ || address >= area_base_ + (next_slot_ * slot_size())) {
+		return false;
+	}
+
+	return ((address - area_base_) % slot_size()) < PAGE_SIZE;
+}
@@ -65,6 +65,8 @@ void memory_manager::init()
 	dprintf("switching to primary page table mapping...\n");
 	activate_primary_mapping();
 
+	kstackalloc_.init();
+
 	dprintf("done\n");
 }
 
@@ -20,6 +20,8 @@ static inline page_metadata *metadata(page *page) { return (page_metadata *)page
 
 void page_allocator_linear::insert_free_pages(page &range_start, u64 page_count)
 {
+	unique_irq_lock l(lock_);
+
 	page **slot = &free_list_;
 
 	while (*slot) {
@@ -38,16 +40,27 @@ page *page_allocator_linear::allocate_pages(int order, page_allocation_flags fla
 	// find a free block with enough pages
 	// take from the end, so we can just reduce the free block size
 
-	page *free_block = free_list_;
+	unique_irq_lock l(lock_);
 
-	while (free_block) {
-		// TODO: Little hack here -- we subtract one so that we don't have to remove the free
-		// block from the list when it's fully used up, since metadata is stored at the start
-		// of the free block.
-		if ((metadata(free_block)->free_block_size - 1) >= page_count) {
+	page **slot = &free_list_;
+
+	while (*slot) {
+		page *free_block = *slot;
+
+		if (metadata(free_block)->free_block_size >= page_count) {
 			metadata(free_block)->free_block_size -= page_count;
 
 			u64 start_pfn = free_block->pfn() + metadata(free_block)->free_block_size;
+
+			// If the block has been used up, its metadata is about to be handed out along with the
+			// rest of it, so it must come off the free list.
+			if (metadata(free_block)->free_block_size == 0) {
+				*slot = metadata(free_block)->next_free;
+			}
+
+			// The pages are ours now, so there's no need to hold the lock while they're zeroed.
+			l.unlock();
+
 			if ((flags & page_allocation_flags::zero) == page_allocation_flags::zero) {
 				memops::pzero(page::get_from_pfn(start_pfn).base_address_ptr(), page_count);
 			}
@@ -55,7 +68,7 @@ page *page_allocator_linear::allocate_pages(int order, page_allocation_flags fla
 			return &page::get_from_pfn(start_pfn);
 		}
 
-		free_block = metadata(free_block)->next_free;
+		slot = &(metadata(free_block)->next_free);
 	}
 
 	return nullptr;
@@ -63,7 +76,23 @@ page *page_allocator_linear::allocate_pages(int order, page_allocation_flags fla
 
 void page_allocator_linear::free_pages(page &base, int order)
 {
-	// TODO
+	u64 page_count = 1 << order;
+
+	unique_irq_lock l(lock_);
+
+	// Allocations are taken from the end of a free block, so pages being freed will usually fit straight
+	// back on to the end of the block they came from.  Otherwise, they go on the front of the list as a
+	// block of their own.  Blocks are only ever merged with the pages being freed, not with each other.
+	for (page *free_block = free_list_; free_block; free_block = metadata(free_block)->next_free) {
+		if (free_block->pfn() + metadata(free_block)->free_block_size == base.pfn()) {
+			metadata(free_block)->free_block_size += page_count;
+			return;
+		}
+	}
+
+	metadata(&base)->next_free = free_list_;
+	metadata(&base)->free_block_size = page_count;
+	free_list_ = &base;
 }
 
 void page_allocator_linear::dump() const
@@ -9,3 +9,41 @@
 
 using namespace stacsos::kernel::obj;
 using namespace stacsos::kernel::sched;
+
+/**
+ * Removes an object from a process's object map.  The object itself is destroyed once the last reference to it has
+ * gone.
+ */
+void object_manager::free_object(process &owner, u64 id)
+{
+	shared_ptr<object> optr;
+
+	{
+		unique_irq_lock l(lock_);
+
+		map<u64, shared_ptr<object>> *process_object_map;
+		if (!objects_.try_get_value(&owner, process_object_map)) {
+			return;
+		}
+
+		process_object_map->remove(id, &optr);
+	}
+}
+
+/**
+ * Removes all the objects belonging to a process, e.g. because it has terminated.
+ */
+void object_manager::free_process_objects(process &owner)
+{
+	map<u64, shared_ptr<object>> *process_object_map;
+
+	{
+		unique_irq_lock l(lock_);
+
+		if (!objects_.remove(&owner, &process_object_map)) {
+			return;
+		}
+	}
+
+	delete process_object_map;
+}
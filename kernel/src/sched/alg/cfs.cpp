@@ -0,0 +1,154 @@
+/* SPDX-License-Identifier: MIT */
+
+/* StACSOS - Kernel
+ *
+ * Copyright (c) University of St Andrews 2024
+ * Tom Spink <tcs6@st-andrews.ac.uk>
+ */
+#include <stacsos/kernel/debug.h>
+#include <stacsos/kernel/sched/alg/cfs.h>
+#include <stacsos/kernel/sched/schedulable-entity.h>
+#include <stacsos/memops.h>
+
+using namespace stacsos;
+using namespace stacsos::kernel::sched;
+using namespace stacsos::kernel::sched::alg;
+
+/**
+ * Advances a task's virtual runtime by the (weighted) amount of real runtime it has accumulated since
+ * it was last charged.
+ */
+void completely_fair_scheduler::charge(tcb &t)
+{
+	u64 delta = t.run_time - t.vruntime_charged;
+	u32 weight = t.weight ? t.weight : default_weight;
+
+	t.vruntime += (delta * default_weight) / weight;
+	t.vruntime_charged = t.run_time;
+}
+
+void completely_fair_scheduler::add_to_runqueue(tcb &tcb)
+{
+	if (count_ == capacity_) {
+		u32 new_capacity = capacity_ ? capacity_ * 2 : 16;
+		auto new_heap = new stacsos::kernel::sched::tcb *[new_capacity];
+
+		if (heap_) {
+			memops::memcpy(new_heap, heap_, sizeof(*heap_) * count_);
+			delete[] heap_;
+		}
+
+		heap_ = new_heap;
+		capacity_ = new_capacity;
+	}
+
+	// Don't let a task that has been away (sleeping, newly created, or on another core) build up
+	// credit that would let it monopolise this core.
+	charge(tcb);
+	tcb.vruntime = max(tcb.vruntime, min_vruntime_);
+
+	place(count_, &tcb);
+	sift_up(count_++);
+}
+
+void completely_fair_scheduler::remove_from_runqueue(tcb &tcb)
+{
+	if (!contains(&tcb)) {
+		return;
+	}
+
+	remove_at(tcb.rq_index);
+}
+
+tcb *completely_fair_scheduler::select_next_task(tcb *current)
+{
+	// The current task has just been charged for its real runtime, so bring its virtual runtime up to
+	// date, and move it to its new position in the heap.
+	if (current && contains(current)) {
+		charge(*current);
+		sift_down(current->rq_index);
+	}
+
+	if (count_ == 0) {
+		return nullptr;
+	}
+
+	tcb *next = heap_[0];
+	min_vruntime_ = max(min_vruntime_, next->vruntime);
+
+	return next;
+}
+
+tcb *completely_fair_scheduler::steal_task(int core_id)
+{
+	// Search from the back of the heap, where the tasks with the largest virtual runtimes tend to be.
+	// Tasks that are still executing on this core can't be migrated.
+	for (u32 i = count_; i > 0; i--) {
+		tcb *candidate = heap_[i - 1];
+
+		if (candidate->running_on == nullptr && can_run_on(*candidate, core_id)) {
+			remove_at(i - 1);
+			return candidate;
+		}
+	}
+
+	return nullptr;
+}
+
+void completely_fair_scheduler::remove_at(u32 index)
+{
+	count_--;
+
+	if (index == count_) {
+		return;
+	}
+
+	// Move the last task into the hole, and restore the heap property in whichever direction is needed.
+	tcb *moved = heap_[count_];
+
+	place(index, moved);
+	sift_up(index);
+	sift_down(moved->rq_index);
+}
+
+void completely_fair_scheduler::sift_up(u32 index)
+{
+	tcb *t = heap_[index];
+
+	while (index > 0) {
+		u32 parent = (index - 1) / 2;
+		if (heap_[parent]->vruntime <= t->vruntime) {
+			break;
+		}
+
+		place(index, heap_[parent]);
+		index = parent;
+	}
+
+	place(index, t);
+}
+
+void completely_fair_scheduler::sift_down(u32 index)
+{
+	tcb *t = heap_[index];
+
+	while (true) {
+		u32 child = (index * 2) + 1;
+		if (child >= count_) {
+			break;
+		}
+
+		if (child + 1 < count_ && heap_[child + 1]->vruntime < heap_[child]->vruntime) {
+			child++;
+		}
+
+		if (t->vruntime <= heap_[child]->vruntime) {
+			break;
+		}
+
+		place(index, heap_[child]);
+		index = child;
+	}
+
+	place(index, t);
+}
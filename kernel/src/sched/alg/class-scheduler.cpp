@@ -0,0 +1,154 @@
+/* SPDX-License-Identifier: MIT */
+
+/* StACSOS - Kernel
+ *
+ * Copyright (c) University of St Andrews 2024
+ * Tom Spink <tcs6@st-andrews.ac.uk>
+ */
+#include <stacsos/kernel/debug.h>
+#include <stacsos/kernel/sched/alg/class-scheduler.h>
+#include <stacsos/kernel/sched/schedulable-entity.h>
+
+using namespace stacsos;
+using namespace stacsos::kernel::sched;
+using namespace stacsos::kernel::sched::alg;
+
+void class_scheduler::add_to_runqueue(tcb &tcb)
+{
+	if (tcb.policy == sched_policy::deadline) {
+		deadline_.add_to_runqueue(tcb);
+	} else if (is_rt_policy(tcb.policy)) {
+		rt_enqueue(tcb);
+	} else {
+		fair_->add_to_runqueue(tcb);
+	}
+}
+
+void class_scheduler::remove_from_runqueue(tcb &tcb)
+{
+	if (tcb.policy == sched_policy::deadline) {
+		deadline_.remove_from_runqueue(tcb);
+	} else if (is_rt_policy(tcb.policy)) {
+		if (rt_contains(tcb)) {
+			rt_dequeue(tcb);
+		}
+	} else {
+		fair_->remove_from_runqueue(tcb);
+	}
+}
+
+tcb *class_scheduler::select_next_task(tcb *current)
+{
+	bool current_is_dl = current && current->policy == sched_policy::deadline;
+	bool current_is_rt = current && is_rt_policy(current->policy);
+
+	tcb *next = deadline_.select_next_task(current_is_dl ? current : nullptr);
+	if (next) {
+		return next;
+	}
+
+	// A round-robin task that is still runnable goes to the back of its queue, so that other tasks at
+	// the same priority get a turn.
+	if (current_is_rt && current->policy == sched_policy::rt_rr && rt_contains(*current) && current->rq_next) {
+		rt_dequeue(*current);
+		rt_enqueue(*current);
+	}
+
+	if (rt_bitmap_) {
+		return rt_heads_[63 - __builtin_clzll(rt_bitmap_)];
+	}
+
+	return fair_->select_next_task(current_is_rt || current_is_dl ? nullptr : current);
+}
+
+tcb *class_scheduler::steal_task(int core_id)
+{
+	tcb *t = fair_->steal_task(core_id);
+	if (t) {
+		return t;
+	}
+
+	// Real-time tasks can be migrated too, starting with the least important.  Deadline tasks stay on
+	// the core that their bandwidth is reserved on.
+	for (u64 bitmap = rt_bitmap_; bitmap; bitmap &= bitmap - 1) {
+		for (tcb *candidate = rt_tails_[__builtin_ctzll(bitmap)]; candidate; candidate = candidate->rq_prev) {
+			if (candidate->running_on == nullptr && can_run_on(*candidate, core_id)) {
+				rt_dequeue(*candidate);
+				return candidate;
+			}
+		}
+	}
+
+	return nullptr;
+}
+
+bool class_scheduler::should_preempt(const tcb &current, const tcb &woken) const
+{
+	if (woken.policy == sched_policy::deadline) {
+		return !woken.dl_throttled && (current.policy != sched_policy::deadline || deadline_.should_preempt(current, woken));
+	}
+
+	if (current.policy == sched_policy::deadline) {
+		return false;
+	}
+
+	if (is_rt_policy(woken.policy)) {
+		return !is_rt_policy(current.policy) || woken.rt_priority > current.rt_priority;
+	}
+
+	return !is_rt_policy(current.policy) && fair_->should_preempt(current, woken);
+}
+
+void class_scheduler::rt_enqueue(tcb &t)
+{
+	u32 prio = t.rt_priority;
+
+	t.rq_next = nullptr;
+	t.rq_prev = rt_tails_[prio];
+
+	if (rt_tails_[prio]) {
+		rt_tails_[prio]->rq_next = &t;
+	} else {
+		rt_heads_[prio] = &t;
+	}
+
+	rt_tails_[prio] = &t;
+	rt_bitmap_ |= 1ull << prio;
+}
+
+void class_scheduler::rt_dequeue(tcb &t)
+{
+	u32 prio = t.rt_priority;
+
+	if (t.rq_prev) {
+		t.rq_prev->rq_next = t.rq_next;
+	} else {
+		rt_heads_[prio] = t.rq_next;
+	}
+
+	if (t.rq_next) {
+		t.rq_next->rq_prev = t.rq_prev;
+	} else {
+		rt_tails_[prio] = t.rq_prev;
+	}
+
+	t.rq_next = t.rq_prev = nullptr;
+
+	if (!rt_heads_[prio]) {
+		rt_bitmap_ &= ~(1ull << prio);
+	}
+}
+
+scheduling_algorithm *class_scheduler::replace_fair(scheduling_algorithm *fair)
+{
+	scheduling_algorithm *old = fair_;
+
+	// Tasks keep their accumulated run time when they move, so the new algorithm starts from a fair
+	// picture of who has had the most CPU.
+	while (tcb *t = old->drain_task()) {
+		fair->add_to_runqueue(*t);
+	}
+
+	fair_ = fair;
+	return old;
+}
@@ -0,0 +1,157 @@
+/* SPDX-License-Identifier: MIT */
+
+/* StACSOS - Kernel
+ *
+ * Copyright (c) University of St Andrews 2024
+ * Tom Spink <tcs6@st-andrews.ac.uk>
+ */
+#include <stacsos/kernel/debug.h>
+#include <stacsos/kernel/sched/alg/edf.h>
+#include <stacsos/kernel/sched/schedulable-entity.h>
+
+using namespace stacsos;
+using namespace stacsos::kernel::sched;
+using namespace stacsos::kernel::sched::alg;
+
+/**
+ * Deducts the real runtime a task has accumulated since it was last charged from its budget.
+ */
+void earliest_deadline_first::charge(tcb &t)
+{
+	u64 delta = t.run_time - t.dl_charged;
+
+	t.dl_budget = delta >= t.dl_budget ? 0 : t.dl_budget - delta;
+	t.dl_charged = t.run_time;
+}
+
+void earliest_deadline_first::add_to_runqueue(tcb &tcb)
+{
+	u64 now = __builtin_ia32_rdtsc();
+
+	charge(tcb);
+
+	if (tcb.dl_abs_deadline != 0 && tcb.dl_budget == 0 && now < next_period_start(tcb)) {
+		// The task has used up its budget for this period, so it has to wait for the next one.
+		tcb.dl_throttled = true;
+	} else {
+		tcb.dl_throttled = false;
+
+		// If the task can't finish its remaining budget by its current deadline without exceeding its
+		// reserved bandwidth (e.g. because it has been asleep), give it a fresh budget and deadline,
+		// so that it can't interfere with the reservations of other tasks.
+		if (now >= tcb.dl_abs_deadline
+			|| (unsigned __int128)tcb.dl_budget * tcb.dl_deadline > (unsigned __int128)(tcb.dl_abs_deadline - now) * tcb.dl_runtime) {
+			tcb.dl_abs_deadline = now + tcb.dl_deadline;
+			tcb.dl_budget = tcb.dl_runtime;
+		}
+	}
+
+	enqueue(tcb);
+}
+
+void earliest_deadline_first::remove_from_runqueue(tcb &tcb)
+{
+	if (!contains(tcb)) {
+		return;
+	}
+
+	charge(tcb);
+	dequeue(tcb);
+}
+
+tcb *earliest_deadline_first::select_next_task(tcb *current)
+{
+	u64 now = __builtin_ia32_rdtsc();
+
+	// Enforce the current task's budget: if it has run out, the task is throttled until the start of
+	// its next period.
+	if (current && contains(*current) && !current->dl_throttled) {
+		charge(*current);
+
+		if (current->dl_budget == 0) {
+			dequeue(*current);
+			current->dl_throttled = true;
+			enqueue(*current);
+		}
+	}
+
+	replenish(now);
+
+	return ready_head_;
+}
+
+/**
+ * Gives every throttled task whose next period has started a new budget and deadline, and makes it
+ * runnable again.
+ */
+void earliest_deadline_first::replenish(u64 now)
+{
+	while (throttled_head_ && next_period_start(*throttled_head_) <= now) {
+		tcb *t = throttled_head_;
+		dequeue(*t);
+
+		t->dl_abs_deadline = next_period_start(*t) + t->dl_deadline;
+		if (t->dl_abs_deadline <= now) {
+			t->dl_abs_deadline = now + t->dl_deadline;
+		}
+
+		t->dl_budget = t->dl_runtime;
+		t->dl_throttled = false;
+		enqueue(*t);
+	}
+}
+
+bool earliest_deadline_first::should_preempt(const tcb &current, const tcb &woken) const
+{
+	return !woken.dl_throttled && woken.dl_abs_deadline < current.dl_abs_deadline;
+}
+
+u64 earliest_deadline_first::next_event() const { return throttled_head_ ? next_period_start(*throttled_head_) : 0; }
+
+/**
+ * Inserts a task into the ready list (sorted by absolute deadline), or the throttled list (sorted by
+ * the start of the next period), depending on whether it has any budget left.
+ */
+void earliest_deadline_first::enqueue(tcb &t)
+{
+	tcb **head = t.dl_throttled ? &throttled_head_ : &ready_head_;
+	u64 key = t.dl_throttled ? next_period_start(t) : t.dl_abs_deadline;
+
+	tcb *prev = nullptr;
+	tcb *next = *head;
+
+	while (next && (t.dl_throttled ? next_period_start(*next) : next->dl_abs_deadline) <= key) {
+		prev = next;
+		next = next->rq_next;
+	}
+
+	t.rq_prev = prev;
+	t.rq_next = next;
+
+	if (prev) {
+		prev->rq_next = &t;
+	} else {
+		*head = &t;
+	}
+
+	if (next) {
+		next->rq_prev = &t;
+	}
+}
+
+void earliest_deadline_first::dequeue(tcb &t)
+{
+	tcb **head = t.dl_throttled ? &throttled_head_ : &ready_head_;
+
+	if (t.rq_prev) {
+		t.rq_prev->rq_next = t.rq_next;
+	} else {
+		*head = t.rq_next;
+	}
+
+	if (t.rq_next) {
+		t.rq_next->rq_prev = t.rq_prev;
+	}
+
+	t.rq_next = t.rq_prev = nullptr;
+}
@@ -34,3 +34,26 @@ tcb *simple_fair_scheduler::select_next_task(tcb *current)
 
 	return candidate;
 }
+
+tcb *simple_fair_scheduler::steal_task(int core_id)
+{
+	// Give away the task that has had the most run time, as it's the one that this core would get around
+	// to last.  Tasks that are still executing on this core can't be migrated.
+	tcb *candidate = nullptr;
+
+	for (auto *thread : runqueue_) {
+		if (thread->running_on != nullptr || !can_run_on(*thread, core_id)) {
+			continue;
+		}
+
+		if (candidate == nullptr || thread->run_time > candidate->run_time) {
+			candidate = thread;
+		}
+	}
+
+	if (candidate) {
+		runqueue_.remove(candidate);
+	}
+
+	return candidate;
+}
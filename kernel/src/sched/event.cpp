@@ -7,39 +7,53 @@
  */
 #include <stacsos/kernel/debug.h>
 #include <stacsos/kernel/sched/event.h>
-#include <stacsos/kernel/sched/thread.h>
 
 using namespace stacsos::kernel::sched;
 
-template <bool AUTO_RESET> void event<AUTO_RESET>::wait()
+/**
+ * Checks whether the event has been triggered, consuming the trigger if this is an auto-reset event.
+ * Called with the wait queue lock held.
+ */
+template <bool AUTO_RESET> bool event<AUTO_RESET>::try_consume()
 {
-	if (!AUTO_RESET && triggered_) {
-		return;
+	if (!triggered_) {
+		return false;
 	}
 
-	// TODO: Race Condition!
+	if (AUTO_RESET) {
+		triggered_ = false;
+	}
 
-	thread *ct = &thread::current();
+	return true;
+}
 
-	wait_list_.append(ct);
-	ct->suspend();
+template <bool AUTO_RESET> void event<AUTO_RESET>::wait()
+{
+	waiters_.wait_until([this] { return try_consume(); });
+}
 
-	asm volatile("int $0xff");
+/**
+ * Waits for the event, for up to the given number of microseconds.  Returns false if the wait timed out.
+ */
+template <bool AUTO_RESET> bool event<AUTO_RESET>::wait(u64 timeout_us)
+{
+	return waiters_.wait_until([this] { return try_consume(); }, timeout_us);
 }
 
 template <bool AUTO_RESET> void event<AUTO_RESET>::trigger()
 {
-	if (!AUTO_RESET) {
-		triggered_ = true;
-	}
+	// The event is updated under the wait queue lock, because the waiter may destroy the event as soon
+	// as it sees the trigger (e.g. if the event lives on its stack).
+	unique_irq_lock l(waiters_.lock());
 
-	// TODO: This should only release ONE thread if it's an auto reset event.
-	// Probably need some kind of mutex too.
-	for (auto thread : wait_list_) {
-		thread->resume();
-	}
+	triggered_ = true;
+	waiters_.wake_n_locked(AUTO_RESET ? 1 : ~0ull);
+}
 
-	wait_list_.clear();
+template <bool AUTO_RESET> void event<AUTO_RESET>::reset()
+{
+	unique_irq_lock l(waiters_.lock());
+	triggered_ = false;
 }
 
 template class event<true>;
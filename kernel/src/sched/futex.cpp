@@ -0,0 +1,87 @@
+/* SPDX-License-Identifier: MIT */
+
+/* StACSOS - Kernel
+ *
+ * Copyright (c) University of St Andrews 2024
+ * Tom Spink <tcs6@st-andrews.ac.uk>
+ */
+#include <stacsos/kernel/debug.h>
+#include <stacsos/kernel/mem/address-space.h>
+#include <stacsos/kernel/sched/futex.h>
+#include <stacsos/kernel/sched/process.h>
+#include <stacsos/kernel/sched/thread.h>
+
+using namespace stacsos::kernel::sched;
+using namespace stacsos::kernel::mem;
+
+/**
+ * Turns a futex address in the given process into its key, i.e. the physical address of the word.
+ * Returns false if the address is misaligned, not a user address, or not mapped.
+ */
+bool futex::translate(process &owner, u64 address, u64 &key)
+{
+	if ((address & 3) != 0 || address >= 0x8000'0000'0000'0000) {
+		return false;
+	}
+
+	auto m = owner.addrspace().pgtable().get_mapping(address);
+	if (m.result != mapping_result::ok) {
+		return false;
+	}
+
+	key = m.address;
+	return true;
+}
+
+/**
+ * Blocks the current thread, so long as the futex word at the given address still holds the expected
+ * value.  If the timeout (in microseconds) is non-zero, the wait is abandoned once it elapses.
+ */
+futex_result futex::wait(process &owner, u64 address, u32 expected, u64 timeout_us)
+{
+	u64 key;
+	if (!translate(owner, address, key)) {
+		return futex_result::invalid_argument;
+	}
+
+	wait_queue &b = bucket_for(key);
+	u64 deadline = timeout_us ? wait_queue::deadline_after_us(timeout_us) : 0;
+
+	{
+		unique_irq_lock l(b.lock());
+
+		// The word is checked under the bucket lock, which a waker must also take, so a wakeup can't
+		// slip in between the check and the thread being queued.  The word is read through the physical
+		// mapping, since it has already been translated.
+		if (*(volatile u32 *)phys_to_virt(key) != expected) {
+			return futex_result::would_block;
+		}
+
+		if (!b.enqueue_current_locked(key, deadline)) {
+			return futex_result::timed_out;
+		}
+	}
+
+	// If we weren't woken by futex::wake, then the timeout must have expired.
+	return b.block_current() ? futex_result::ok : futex_result::timed_out;
+}
+
+/**
+ * Wakes up to the given number of threads waiting on the futex word at the given address, in the
+ * order in which they started waiting.
+ */
+futex_result futex::wake(process &owner, u64 address, u64 count, u64 &nr_woken)
+{
+	nr_woken = 0;
+
+	u64 key;
+	if (!translate(owner, address, key)) {
+		return futex_result::invalid_argument;
+	}
+
+	wait_queue &b = bucket_for(key);
+	unique_irq_lock l(b.lock());
+
+	nr_woken = b.wake_keyed_locked(key, count);
+	return futex_result::ok;
+}
@@ -0,0 +1,147 @@
+/* SPDX-License-Identifier: MIT */
+
+/* StACSOS - Kernel
+ *
+ * Copyright (c) University of St Andrews 2024
+ * Tom Spink <tcs6@st-andrews.ac.uk>
+ */
+#include <stacsos/kernel/arch/core.h>
+#include <stacsos/kernel/debug.h>
+#include <stacsos/kernel/sched/mutex.h>
+
+using namespace stacsos::kernel::sched;
+using namespace stacsos::kernel::arch;
+
+// The maximum number of times to poll a mutex whose owner is running, before going to sleep.
+static const int max_spin = 1000;
+
+static tcb *current_task() { return core::this_core().get_current_tcb(); }
+
+bool mutex::try_lock()
+{
+	tcb *expected = nullptr;
+	return __atomic_compare_exchange_n(&owner_, &expected, current_task(), false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+/**
+ * Spins while the mutex is held by a task that is running on another core, since it will probably
+ * release the mutex before we could go to sleep and be woken up again.  Returns true if the mutex was
+ * acquired.
+ */
+bool mutex::spin_on_owner()
+{
+	for (int i = 0; i < max_spin; i++) {
+		tcb *owner = __atomic_load_n(&owner_, __ATOMIC_RELAXED);
+
+		if (!owner) {
+			if (try_lock()) {
+				return true;
+			}
+		} else if (((volatile tcb *)owner)->running_on == nullptr) {
+			// The owner isn't running, so it won't be releasing the mutex any time soon.
+			return false;
+		}
+
+		__relax();
+	}
+
+	return false;
+}
+
+void mutex::lock()
+{
+	if (try_lock() || spin_on_owner()) {
+		return;
+	}
+
+	waiters_.wait_until([this] { return try_lock(); });
+}
+
+void mutex::unlock()
+{
+	__atomic_store_n(&owner_, nullptr, __ATOMIC_RELEASE);
+
+	// The woken waiter has to compete for the mutex with any spinners, and goes back to sleep if it loses.
+	waiters_.wake_one();
+}
+
+bool rw_semaphore::try_down_read()
+{
+	unique_irq_lock l(waiters_.lock());
+
+	if (!can_read()) {
+		return false;
+	}
+
+	state_++;
+	return true;
+}
+
+void rw_semaphore::down_read()
+{
+	waiters_.wait_until([this] {
+		if (!can_read()) {
+			return false;
+		}
+
+		state_++;
+		return true;
+	});
+}
+
+void rw_semaphore::up_read()
+{
+	unique_irq_lock l(waiters_.lock());
+
+	// The last reader out lets the waiting writers in.
+	if (--state_ == 0 && writers_waiting_) {
+		waiters_.wake_n_locked(~0ull);
+	}
+}
+
+bool rw_semaphore::try_down_write()
+{
+	unique_irq_lock l(waiters_.lock());
+
+	if (state_ != 0) {
+		return false;
+	}
+
+	state_ = -1;
+	return true;
+}
+
+void rw_semaphore::down_write()
+{
+	bool counted = false;
+
+	waiters_.wait_until([this, &counted] {
+		if (state_ == 0) {
+			state_ = -1;
+
+			if (counted) {
+				writers_waiting_--;
+			}
+
+			return true;
+		}
+
+		// Register as a waiting writer the first time round, which stops new readers from getting in.
+		if (!counted) {
+			writers_waiting_++;
+			counted = true;
+		}
+
+		return false;
+	});
+}
+
+void rw_semaphore::up_write()
+{
+	unique_irq_lock l(waiters_.lock());
+
+	// Wake everyone: either the next writer will get in, or (if there are no writers waiting) all of the
+	// readers will.
+	state_ = 0;
+	waiters_.wake_n_locked(~0ull);
+}
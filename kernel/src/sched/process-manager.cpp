@@ -32,7 +32,7 @@ shared_ptr<process> process_manager::create_kernel_process(continuation_fn cfn)
 	kernel_process->create_thread((u64)cfn);
 
 	auto kernel_process_ptr = shared_ptr(kernel_process);
-	active_processes_.append(kernel_process_ptr);
+	add_process(kernel_process_ptr);
 
 	kernel_process_ = kernel_process_ptr;
 	return kernel_process_ptr;
@@ -112,7 +112,46 @@ shared_ptr<process> process_manager::create_process(const char *path, const char
 	proc->create_thread(ehdr->e_entry, (void *)data_page->base);
 
 	auto pp = shared_ptr(proc);
-	active_processes_.append(pp);
+	add_process(pp);
 
 	return pp;
 }
+
+void process_manager::add_process(shared_ptr<process> proc)
+{
+	unique_irq_lock l(active_processes_lock_);
+	active_processes_.append(proc);
+}
+
+/**
+ * Forgets about a process that has been torn down.  The process object itself is destroyed once the last reference
+ * to it has gone, so this may be the end of it.
+ */
+void process_manager::remove_process(process &proc)
+{
+	shared_ptr<process> pp;
+
+	{
+		unique_irq_lock l(active_processes_lock_);
+
+		for (const auto &candidate : active_processes_) {
+			if (candidate.get() == &proc) {
+				pp = candidate;
+				break;
+			}
+		}
+
+		if (pp) {
+			active_processes_.remove(pp);
+		}
+	}
+}
+
+/**
+ * Returns a snapshot of the processes that are currently active.
+ */
+list<shared_ptr<process>> process_manager::processes()
+{
+	unique_irq_lock l(active_processes_lock_);
+	return active_processes_;
+}
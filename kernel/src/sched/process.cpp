@@ -5,51 +5,137 @@
  * Copyright (c) University of St Andrews 2024
  * Tom Spink <tcs6@st-andrews.ac.uk>
  */
+#include <stacsos/kernel/arch/core-manager.h>
+#include <stacsos/kernel/arch/core.h>
 #include <stacsos/kernel/mem/address-space.h>
+#include <stacsos/kernel/obj/object-manager.h>
 #include <stacsos/kernel/sched/process.h>
+#include <stacsos/kernel/sched/reaper.h>
 #include <stacsos/kernel/sched/thread.h>
 
 using namespace stacsos;
 using namespace stacsos::kernel::sched;
 using namespace stacsos::kernel::mem;
+using namespace stacsos::kernel::obj;
+using namespace stacsos::kernel::arch;
 
 shared_ptr<thread> process::create_thread(u64 entry_point, void *entry_arg)
 {
 	u64 user_stack = 0;
 	if (priv_ == exec_privilege::user) {
-		u64 stack_base = next_user_stack_;
+		u64 stack_base;
 		u64 stack_size = 0x4000;
 
-		next_user_stack_ += stack_size + 0x1000; // Allocate the stack size, but plus a "guard page".
+		{
+			unique_irq_lock l(lock_);
+
+			stack_base = next_user_stack_;
+			next_user_stack_ += stack_size + 0x1000; // Allocate the stack size, but plus a "guard page".
+		}
 
 		user_stack = stack_base + stack_size;
 		addrspace().add_region(stack_base, stack_size, region_flags::readwrite, true);
 	}
 
 	shared_ptr<thread> t = shared_ptr(new thread(*this, entry_point, entry_arg, user_stack));
-	threads_.append(t);
+
+	{
+		unique_irq_lock l(lock_);
+		threads_.append(t);
+	}
 
 	return t;
 }
 
+/**
+ * Returns a snapshot of this process's threads.
+ */
+list<shared_ptr<thread>> process::threads()
+{
+	unique_irq_lock l(lock_);
+	return threads_;
+}
+
 void process::start()
 {
-	for (auto &t : threads_) {
+	for (auto &t : threads()) {
 		t->start();
 	}
 
 	state_ = process_state::started;
-	state_changed_event_.trigger();
+	state_changed_queue_.wake_all();
 }
 
 void process::stop()
 {
-	for (auto &t : threads_) {
+	for (auto &t : threads()) {
 		t->stop();
 	}
 
-	state_ = process_state::terminated;
-	state_changed_event_.trigger();
+	terminate();
+}
+
+/**
+ * Marks this process as terminated (if it wasn't already), and hands it over to the reaper to be torn down.
+ */
+void process::terminate()
+{
+	{
+		unique_irq_lock l(state_changed_queue_.lock());
+
+		if (state_ == process_state::terminated) {
+			return;
+		}
+
+		state_ = process_state::terminated;
+		state_changed_queue_.wake_n_locked(~0ull);
+	}
+
+	reaper::get().reap_process(*this);
+}
+
+/**
+ * Frees the resources of a terminated process, i.e. its objects, memory and page tables.  Returns false if any of its
+ * threads are still running, or its page tables are still loaded on a core, in which case the caller must try again
+ * later.
+ */
+bool process::release_resources()
+{
+	for (auto &t : threads()) {
+		if (!t->resources_released()) {
+			return false;
+		}
+	}
+
+	if (!vma_) {
+		return true;
+	}
+
+	bool in_use = false;
+	for (auto *c : core_manager::get().cores()) {
+		if (!c->release_address_space(vma_->pgtable().effective_cr3())) {
+			in_use = true;
+		}
+	}
+
+	if (in_use) {
+		return false;
+	}
+
+	object_manager::get().free_process_objects(*this);
+
+	delete vma_;
+	vma_ = nullptr;
+
+	return true;
+}
+
+/**
+ * Blocks the calling thread until this process has moved out of the given state.
+ */
+void process::wait_for_state_change(process_state from)
+{
+	state_changed_queue_.wait_until([this, from] { return state_ != from; });
 }
 
 void process::on_thread_stopped(thread &thread)
@@ -61,13 +147,12 @@ void process::on_thread_stopped(thread &thread)
 		return;
 	}
 
-	for (auto &t : threads_) {
+	for (auto &t : threads()) {
 		if (t->state() != thread_states::terminated) {
 			return;
 		}
 	}
 
 	dprintf("proc: terminated\n");
-	state_ = process_state::terminated;
-	state_changed_event_.trigger();
+	terminate();
 }
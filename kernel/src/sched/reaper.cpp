@@ -0,0 +1,123 @@
+/* SPDX-License-Identifier: MIT */
+
+/* StACSOS - Kernel
+ *
+ * Copyright (c) University of St Andrews 2024
+ * Tom Spink <tcs6@st-andrews.ac.uk>
+ */
+#include <stacsos/kernel/debug.h>
+#include <stacsos/kernel/sched/process-manager.h>
+#include <stacsos/kernel/sched/process.h>
+#include <stacsos/kernel/sched/reaper.h>
+#include <stacsos/kernel/sched/thread.h>
+
+using namespace stacsos;
+using namespace stacsos::kernel::sched;
+
+void reaper::init()
+{
+	dprintf("reaper: init\n");
+
+	auto t = process_manager::get().kernel_process()->create_thread((u64)reaper_thread_proc);
+	t->start();
+}
+
+void reaper::reap_thread(thread &t)
+{
+	unique_irq_lock l(work_.lock());
+
+	threads_.append(&t);
+	new_work_ = true;
+	work_.wake_n_locked(1);
+}
+
+void reaper::reap_process(process &p)
+{
+	unique_irq_lock l(work_.lock());
+
+	processes_.append(&p);
+	new_work_ = true;
+	work_.wake_n_locked(1);
+}
+
+void reaper::resources_released()
+{
+	// This is called on every context switch, so it must be cheap when there's nothing to wait for.
+	if (!__atomic_load_n(&waiting_, __ATOMIC_SEQ_CST)) {
+		return;
+	}
+
+	unique_irq_lock l(work_.lock());
+
+	release_seq_++;
+	work_.wake_n_locked(1);
+}
+
+void reaper::reaper_thread_proc()
+{
+	auto &r = reaper::get();
+	u64 seen_seq = 0;
+
+	while (true) {
+		// Make a pass whenever there's new work, or something that was in use last time may have been let go of.
+		// Cores only report releases while the reaper is waiting for them, and the waiting flag is raised before
+		// anything is checked, so a release can't fall between a check and the reaper going to sleep.
+		r.work_.wait_until([&r, &seen_seq] {
+			if (!r.new_work_ && r.release_seq_ == seen_seq) {
+				return false;
+			}
+
+			r.new_work_ = false;
+			seen_seq = r.release_seq_;
+			__atomic_store_n(&r.waiting_, true, __ATOMIC_SEQ_CST);
+
+			return true;
+		});
+
+		r.reap();
+	}
+}
+
+/**
+ * Makes one pass over the terminated threads and processes.  Anything that is still in use is put back, to be looked at
+ * again when a core next lets go of something.
+ */
+void reaper::reap()
+{
+	unique_irq_lock l(work_.lock());
+	list<thread *> threads(move(threads_));
+	list<process *> processes(move(processes_));
+	l.unlock();
+
+	list<thread *> busy_threads;
+	list<process *> busy_processes;
+
+	for (thread *t : threads) {
+		if (!t->release_resources()) {
+			busy_threads.append(t);
+		}
+	}
+
+	// A process's threads all terminate before it does, so they are always seen here first.
+	for (process *p : processes) {
+		if (p->release_resources()) {
+			process_manager::get().remove_process(*p);
+		} else {
+			busy_processes.append(p);
+		}
+	}
+
+	l.lock();
+
+	for (thread *t : busy_threads) {
+		threads_.append(t);
+	}
+
+	for (process *p : busy_processes) {
+		processes_.append(p);
+	}
+
+	if (threads_.empty() && processes_.empty()) {
+		__atomic_store_n(&waiting_, false, __ATOMIC_SEQ_CST);
+	}
+}
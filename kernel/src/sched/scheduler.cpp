@@ -7,14 +7,144 @@
  */
 #include <stacsos/kernel/arch/core-manager.h>
 #include <stacsos/kernel/arch/core.h>
+#include <stacsos/kernel/config.h>
 #include <stacsos/kernel/sched/schedulable-entity.h>
 #include <stacsos/kernel/sched/scheduler.h>
 
+using namespace stacsos;
 using namespace stacsos::kernel::sched;
 using namespace stacsos::kernel::arch;
 
-// TODO: support multicore.
+/**
+ * Chooses the core that a newly runnable task should be placed on.  A deadline task goes to the core
+ * that its bandwidth is reserved on.  Otherwise, this is the online core in the task's affinity mask
+ * with the fewest runnable tasks.  If none of those cores are online yet (i.e. during start-up), the
+ * task waits on the first core in its mask, or the bootstrap core.
+ */
+static core *select_core(const tcb &t)
+{
+	if (t.policy == sched_policy::deadline && t.dl_core >= 0) {
+		return &core_manager::get().get_core(t.dl_core);
+	}
+
+	core *best = nullptr;
+	core *fallback = nullptr;
+
+	for (auto *c : core_manager::get().cores()) {
+		if (!can_run_on(t, c->id())) {
+			continue;
+		}
+
+		if (fallback == nullptr) {
+			fallback = c;
+		}
+
+		if (c->status() != core_status::online) {
+			continue;
+		}
+
+		if (best == nullptr || c->runqueue_length() < best->runqueue_length()) {
+			best = c;
+		}
+	}
+
+	if (best) {
+		return best;
+	}
 
-void scheduler::add_to_schedule(schedulable_entity &e) { core_manager::get().get_core(0).add_to_runqueue(*e.get_tcb()); }
+	return fallback ? fallback : &core_manager::get().get_boot_core();
+}
+
+void scheduler::add_to_schedule(schedulable_entity &e)
+{
+	tcb *t = e.get_tcb();
+
+	// A task that is still executing on a core (e.g. it was woken up before it managed to switch away)
+	// must stay on that core, because its kernel stack is still in use there.
+	core *target = ((volatile tcb *)t)->running_on;
+	if (target == nullptr) {
+		target = select_core(*t);
+	}
+
+	target->add_to_runqueue(*t);
+}
+
+void scheduler::remove_from_schedule(schedulable_entity &e)
+{
+	// The task may be migrated between cores by the load balancer, so keep trying until the core that
+	// owns it is the one that removes it.
+	while (true) {
+		core *owner = *(core *volatile *)&e.owning_core_;
+		if (owner == nullptr || owner->remove_from_runqueue(*e.get_tcb())) {
+			return;
+		}
+	}
+}
+
+/**
+ * Admission control for deadline tasks, which is done per core, as a deadline task always runs on the
+ * core that its bandwidth is reserved on.  Replaces a reservation of old_bandwidth on old_core (if it
+ * isn't -1) with one of new_bandwidth on an online core in the affinity mask, without taking any core
+ * past the configured share (dl_limit, as a percentage) of its time.  The old core is kept if the new
+ * reservation fits there, so that changing a task's parameters doesn't move it needlessly.  Otherwise,
+ * the core with the most room left is chosen (i.e. worst fit), which spreads deadline tasks out.
+ *
+ * Returns the id of the core that the bandwidth is now reserved on, or -1 (leaving the existing
+ * reservation in place) if no core has room.
+ */
+int scheduler::reserve_bandwidth(u64 affinity, int old_core, u64 old_bandwidth, u64 new_bandwidth)
+{
+	u64 limit = (bandwidth_unit * config::get().get_option_u64_or_default("dl_limit", 95)) / 100;
+
+	unique_irq_lock l(bandwidth_lock_);
+
+	int best = -1;
+	u64 best_room = 0;
+
+	for (auto *c : core_manager::get().cores()) {
+		int id = c->id();
+		if (c->status() != core_status::online || !((affinity >> id) & 1)) {
+			continue;
+		}
+
+		u64 reserved = reserved_bandwidth_[id] - (id == old_core ? old_bandwidth : 0);
+		if (reserved + new_bandwidth > limit) {
+			continue;
+		}
+
+		u64 room = limit - reserved - new_bandwidth;
+		if (id == old_core) {
+			best = id;
+			break;
+		}
+
+		if (best < 0 || room > best_room) {
+			best = id;
+			best_room = room;
+		}
+	}
+
+	if (best < 0) {
+		return -1;
+	}
+
+	if (old_core >= 0) {
+		reserved_bandwidth_[old_core] -= old_bandwidth;
+	}
+
+	reserved_bandwidth_[best] += new_bandwidth;
+	return best;
+}
+
+/**
+ * Hands back a deadline task's reservation on the given core (which may be -1, if there isn't one).
+ */
+void scheduler::release_bandwidth(int core_id, u64 bandwidth)
+{
+	if (core_id < 0) {
+		return;
+	}
 
-void scheduler::remove_from_schedule(schedulable_entity &e) { core_manager::get().get_core(0).remove_from_runqueue(*e.get_tcb()); }
+	unique_irq_lock l(bandwidth_lock_);
+	reserved_bandwidth_[core_id] -= bandwidth;
+}
@@ -27,29 +27,221 @@ void sleeper::do_sleep(u64 wakeup_deadline)
 	thread *ct = &thread::current();
 	ct->suspend();
 
-	sleeping_thread *st = new sleeping_thread { ct, wakeup_deadline };
-	sleeping_.append(st);
+	arm(*ct, wakeup_deadline);
 
 	// dprintf("sleeper: sleeping %p deadline=%lu\n", ct, wakeup_deadline);
 
-	asm volatile("int $0xff");
+	x86_core::this_core().switch_to_next();
+}
+
+/**
+ * Arms the given thread's wakeup timer, so that the thread is resumed once the deadline (in timestamp
+ * counter ticks) has passed.  This is for threads that are suspending themselves, e.g. for a timed wait,
+ * and the timer should be disarmed with cancel() if the thread is woken up by other means.
+ */
+void sleeper::arm(thread &t, u64 wakeup_deadline)
+{
+	// The timer is armed on this core, so that it's this core's timer interrupt that wakes the thread.
+	int core_id = x86_core::this_core_id();
+	sleep_timer &st = t.sleep_timer();
+
+	// The timer may still be on another core's expired list, if that core has only just woken the
+	// thread up, so wait for it to be done with it.
+	wait_for_expiry(st);
+	st.wakeup_deadline = wakeup_deadline;
+
+	unique_irq_lock l(queues_[core_id].lock);
+
+	st.core = core_id;
+	insert(queues_[core_id], st);
+}
+
+/**
+ * Returns the earliest wakeup deadline of the threads sleeping on the given core, or zero if there
+ * aren't any.
+ */
+u64 sleeper::next_deadline(arch::core &c)
+{
+	timer_queue &q = queues_[c.id()];
+	unique_irq_lock l(q.lock);
+
+	return q.root ? q.root->wakeup_deadline : 0;
 }
 
 void sleeper::check_wakeup()
 {
 	u64 ref_time = x86_core::this_core().local_tsc().read();
+	timer_queue &q = queues_[x86_core::this_core_id()];
+
+	// Take the expired timers off the queue under the lock (chaining them together through their
+	// dedicated expiry links), and resume the threads afterwards.  Each timer is marked as expiring
+	// until its thread has been resumed, so that it isn't re-armed or freed underneath us.
+	sleep_timer *expired = nullptr;
+
+	{
+		unique_irq_lock l(q.lock);
+
+		while (q.root && ref_time > q.root->wakeup_deadline) {
+			sleep_timer *t = q.root;
+			remove(q, *t);
+
+			t->expiring = true;
+			t->core = -1;
+			t->next_expired = expired;
+			expired = t;
+		}
+	}
+
+	while (expired) {
+		sleep_timer *next = expired->next_expired;
 
-	// TODO: some kind of priority queue
-	list<sleeping_thread *> resumed;
-	for (auto sleeping : sleeping_) {
-		if (ref_time > sleeping->wakeup_deadline) {
-			// dprintf("sleeper: waking %p\n", sleeping->thr);
-			sleeping->thr->resume();
-			resumed.append(sleeping);
+		// dprintf("sleeper: waking %p\n", expired->thr);
+		expired->thr->resume();
+
+		expired->next_expired = nullptr;
+		__atomic_store_n(&expired->expiring, false, __ATOMIC_RELEASE);
+		expired = next;
+	}
+}
+
+/**
+ * Waits for another core to finish expiring the given timer, i.e. to finish resuming its thread.
+ */
+void sleeper::wait_for_expiry(sleep_timer &st)
+{
+	while (__atomic_load_n(&st.expiring, __ATOMIC_ACQUIRE)) {
+		__relax();
+	}
+}
+
+/**
+ * Disarms the given thread's wakeup timer, if it is armed.  Returns true if the timer was disarmed
+ * before it expired.
+ */
+bool sleeper::cancel(thread &t)
+{
+	sleep_timer &st = t.sleep_timer();
+
+	// The timer may expire on its core while we're looking at it, so check again under the lock.
+	while (true) {
+		int core_id = *(volatile int *)&st.core;
+		if (core_id < 0) {
+			// If the timer is expiring, its thread is being resumed; wait for that to finish, so the
+			// caller can safely reuse (or free) the thread.
+			wait_for_expiry(st);
+			return false;
+		}
+
+		timer_queue &q = queues_[core_id];
+		unique_irq_lock l(q.lock);
+
+		if (st.core == core_id) {
+			remove(q, st);
+			st.core = -1;
+
+			return true;
 		}
 	}
+}
 
-	for (auto resume : resumed) {
-		sleeping_.remove(resume);
+sleep_timer *sleeper::meld(sleep_timer *a, sleep_timer *b)
+{
+	if (!a) {
+		return b;
 	}
+
+	if (!b) {
+		return a;
+	}
+
+	if (b->wakeup_deadline < a->wakeup_deadline) {
+		auto tmp = a;
+		a = b;
+		b = tmp;
+	}
+
+	// B becomes the first child of A.
+	b->prev = a;
+	b->sibling = a->child;
+
+	if (a->child) {
+		a->child->prev = b;
+	}
+
+	a->child = b;
+	a->sibling = nullptr;
+
+	return a;
+}
+
+sleep_timer *sleeper::merge_pairs(sleep_timer *first)
+{
+	// First pass: meld siblings together in pairs, from left to right, building up a (reversed)
+	// list of the results.
+	sleep_timer *pairs = nullptr;
+
+	while (first) {
+		sleep_timer *a = first;
+		sleep_timer *b = a->sibling;
+
+		if (!b) {
+			a->sibling = pairs;
+			pairs = a;
+			break;
+		}
+
+		first = b->sibling;
+		a->sibling = b->sibling = nullptr;
+
+		sleep_timer *m = meld(a, b);
+		m->sibling = pairs;
+		pairs = m;
+	}
+
+	// Second pass: meld the pairs together, from right to left.
+	sleep_timer *result = nullptr;
+
+	while (pairs) {
+		sleep_timer *next = pairs->sibling;
+		pairs->sibling = nullptr;
+
+		result = meld(result, pairs);
+		pairs = next;
+	}
+
+	return result;
+}
+
+void sleeper::insert(timer_queue &q, sleep_timer &t)
+{
+	t.child = t.sibling = t.prev = nullptr;
+
+	q.root = meld(q.root, &t);
+	q.root->prev = nullptr;
+}
+
+void sleeper::remove(timer_queue &q, sleep_timer &t)
+{
+	if (&t == q.root) {
+		q.root = merge_pairs(t.child);
+	} else {
+		// Unlink the timer from its parent (or left sibling), and meld its children back into the heap.
+		if (t.prev->child == &t) {
+			t.prev->child = t.sibling;
+		} else {
+			t.prev->sibling = t.sibling;
+		}
+
+		if (t.sibling) {
+			t.sibling->prev = t.prev;
+		}
+
+		q.root = meld(q.root, merge_pairs(t.child));
+	}
+
+	if (q.root) {
+		q.root->prev = nullptr;
+	}
+
+	t.child = t.sibling = t.prev = nullptr;
 }
@@ -5,11 +5,15 @@
  * Copyright (c) University of St Andrews 2024
  * Tom Spink <tcs6@st-andrews.ac.uk>
  */
+#include <stacsos/kernel/arch/core-manager.h>
 #include <stacsos/kernel/arch/core.h>
+#include <stacsos/kernel/arch/x86/fpu.h>
+#include <stacsos/kernel/arch/x86/x86-core.h>
 #include <stacsos/kernel/mem/memory-manager.h>
-#include <stacsos/kernel/mem/page.h>
 #include <stacsos/kernel/sched/process.h>
+#include <stacsos/kernel/sched/reaper.h>
 #include <stacsos/kernel/sched/scheduler.h>
+#include <stacsos/kernel/sched/sleeper.h>
 #include <stacsos/kernel/sched/thread.h>
 #include <stacsos/memops.h>
 
@@ -17,6 +21,82 @@ using namespace stacsos::kernel::sched;
 using namespace stacsos::kernel::mem;
 using stacsos::kernel::arch::x86::machine_context;
 
+/**
+ * Restricts this thread to running on the cores in the given mask (where bit n represents core n).
+ * Returns false if the mask doesn't contain any cores, or if this is a deadline thread and none of
+ * the cores have room for its reservation.
+ */
+bool thread::set_affinity(u64 mask)
+{
+	u64 valid_cores = 0;
+	for (auto *c : core_manager::get().cores()) {
+		// The mask only has room for 64 cores.
+		if (c->id() < 64) {
+			valid_cores |= 1ull << c->id();
+		}
+	}
+
+	mask &= valid_cores;
+	if (mask == 0) {
+		return false;
+	}
+
+	core *running_on;
+	bool must_move = false;
+	{
+		unique_irq_lock l(state_lock_);
+
+		// A deadline thread's bandwidth must be reserved on one of its new cores.
+		int dl_core = tcb_.dl_core;
+		if (tcb_.policy == sched_policy::deadline && dl_core >= 0 && !((mask >> dl_core) & 1)) {
+			u64 bw = deadline_bandwidth();
+
+			dl_core = scheduler::get().reserve_bandwidth(mask, dl_core, bw, bw);
+			if (dl_core < 0) {
+				return false;
+			}
+		}
+
+		// The new mask takes effect when the thread is next placed on a core, so re-queue a runnable
+		// thread straight away.  A thread that is executing has to stay on its core until it has been
+		// switched away from, because its kernel stack is in use there, so that core is asked to
+		// reschedule, and it moves the thread on (see core::schedule).
+		bool queued = state_ == thread_states::runnable || state_ == thread_states::running;
+		if (queued) {
+			scheduler::get().remove_from_schedule(*this);
+		}
+
+		tcb_.affinity = mask;
+		tcb_.dl_core = dl_core;
+
+		if (queued) {
+			scheduler::get().add_to_schedule(*this);
+		}
+
+		running_on = ((volatile tcb *)&tcb_)->running_on;
+		if (running_on) {
+			must_move = dl_core >= 0 ? dl_core != running_on->id() : !can_run_on(tcb_, running_on->id());
+		}
+	}
+
+	if (must_move) {
+		running_on->request_resched();
+
+		// If this thread has just excluded the core it's running on, switch away now, and carry on
+		// from one of its permitted cores.
+		if (is_self()) {
+			running_on->switch_to_next();
+		}
+	}
+
+	return true;
+}
+
+/**
+ * Returns the share of a core that is reserved for a deadline task with the given runtime and period.
+ */
+static u64 bandwidth(u64 runtime, u64 period) { return (runtime * scheduler::bandwidth_unit) / period; }
+
 thread::thread(process &owner, u64 ep, void *ep_arg, u64 user_stack)
 	: owner_(owner)
 	, ep_(ep)
@@ -25,6 +105,13 @@ thread::thread(process &owner, u64 ep, void *ep_arg, u64 user_stack)
 	, kernel_stack_(nullptr)
 	, user_stack_(user_stack)
 {
+	memops::bzero(&sleep_timer_, sizeof(sleep_timer_));
+	sleep_timer_.thr = this;
+	sleep_timer_.core = -1;
+
+	memops::bzero(&wait_entry_, sizeof(wait_entry_));
+	wait_entry_.thr = this;
+
 	init_tcb();
 	change_state(thread_states::created);
 }
@@ -42,12 +129,201 @@ bool thread::is_self() const { return &thread::current() == this; }
 void thread::start() { change_state(thread_states::runnable); }
 void thread::stop()
 {
-	change_state(thread_states::terminated);
+	// Make sure a sleeping thread isn't woken up after it has been terminated.
+	sleeper::get().cancel(*this);
+
+	if (!change_state(thread_states::terminated)) {
+		return;
+	}
+
+	// A thread that was blocked can't be left on its wait queue, as the queue may outlive it.
+	wait_queue::cancel(wait_entry_);
+
+	// Hand back any bandwidth reserved for a deadline task.
+	if (tcb_.policy == sched_policy::deadline) {
+		scheduler::get().release_bandwidth(tcb_.dl_core, deadline_bandwidth());
+		tcb_.dl_core = -1;
+		tcb_.policy = sched_policy::normal;
+	}
+
+	reaper::get().reap_thread(*this);
 	owner_.on_thread_stopped(*this);
 }
+
+/**
+ * Frees the parts of a terminated thread that are only needed while it runs, i.e. its kernel stack and extended
+ * register state.  Returns false if the thread hasn't been switched away from yet, in which case they're still in use.
+ */
+bool thread::release_resources()
+{
+	// The previous task's running_on is cleared once its core has left its kernel stack (see TRAP_COMPLETE).
+	if (((volatile tcb *)&tcb_)->running_on != nullptr) {
+		return false;
+	}
+
+	for (auto *c : core_manager::get().cores()) {
+		c->forget_task(tcb_);
+	}
+
+	if (tcb_.fpu_state) {
+		x86::fpu::free_state(tcb_.fpu_state);
+		tcb_.fpu_state = nullptr;
+	}
+
+	if (kernel_stack_) {
+		memory_manager::get().kstackalloc().free(kernel_stack_);
+		kernel_stack_ = nullptr;
+	}
+
+	return true;
+}
 void thread::suspend() { change_state(thread_states::suspended); }
 void thread::resume() { change_state(thread_states::runnable); }
 
+/**
+ * Blocks the calling thread until this thread has terminated.
+ */
+void thread::join()
+{
+	join_queue_.wait_until([this] { return state_ == thread_states::terminated; });
+}
+
+/**
+ * Changes the scheduling policy (and real-time priority) of this thread.  Returns false if the
+ * policy or priority is invalid.
+ */
+bool thread::set_sched_policy(sched_policy policy, u32 rt_priority)
+{
+	// Deadline tasks need parameters, so they must be set up with set_deadline.
+	if (policy >= sched_policy::nr_policies || policy == sched_policy::deadline
+		|| (is_rt_policy(policy) && rt_priority > max_rt_priority)) {
+		return false;
+	}
+
+	unique_irq_lock l(state_lock_);
+
+	if (tcb_.policy == sched_policy::deadline) {
+		scheduler::get().release_bandwidth(tcb_.dl_core, deadline_bandwidth());
+		tcb_.dl_core = -1;
+	}
+
+	// A runnable thread is queued according to its policy, so it needs to be re-queued.
+	bool queued = state_ == thread_states::runnable || state_ == thread_states::running;
+	if (queued) {
+		scheduler::get().remove_from_schedule(*this);
+	}
+
+	sched_policy old_policy = tcb_.policy;
+
+	tcb_.policy = policy;
+	tcb_.rt_priority = is_rt_policy(policy) ? rt_priority : 0;
+
+	if (policy != old_policy) {
+		// The old time slice was for the old policy (and may never expire, e.g. for rt_fifo), so start a new one.
+		tcb_.slice_expiry = 0;
+
+		// Time spent as a real-time or deadline task doesn't count towards the fair share, so a task
+		// becoming fair again is placed alongside the others, rather than being charged for all of it.
+		if (old_policy == sched_policy::deadline || (is_rt_policy(old_policy) && !is_rt_policy(policy))) {
+			tcb_.vruntime = 0;
+			tcb_.vruntime_charged = tcb_.run_time;
+		}
+	}
+
+	if (queued) {
+		scheduler::get().add_to_schedule(*this);
+
+		// If the thread is running, its core needs to take the new policy into account.
+		core *running_on = ((volatile tcb *)&tcb_)->running_on;
+		if (running_on) {
+			running_on->request_resched();
+		}
+	}
+
+	return true;
+}
+
+/**
+ * Makes this thread a deadline task, which may run for runtime_us in every period of period_us, and
+ * must do so within deadline_us of the start of the period.  The deadline defaults to the period if
+ * it is zero.  The request is rejected if it would over-subscribe the cores.
+ */
+deadline_result thread::set_deadline(u64 runtime_us, u64 deadline_us, u64 period_us)
+{
+	if (deadline_us == 0) {
+		deadline_us = period_us;
+	}
+
+	// Periods are limited to ten seconds, which keeps the conversion to TSC ticks from overflowing.
+	if (runtime_us == 0 || runtime_us > deadline_us || deadline_us > period_us || period_us > 10000000) {
+		return deadline_result::invalid_argument;
+	}
+
+	u64 tsc_frequency = x86::x86_core::this_core().local_tsc().frequency();
+	u64 runtime = (runtime_us * tsc_frequency) / 1000000;
+	u64 deadline = (deadline_us * tsc_frequency) / 1000000;
+	u64 period = (period_us * tsc_frequency) / 1000000;
+
+	unique_irq_lock l(state_lock_);
+
+	bool was_deadline = tcb_.policy == sched_policy::deadline;
+	u64 old_bandwidth = was_deadline ? deadline_bandwidth() : 0;
+	u64 new_bandwidth = bandwidth(runtime, period);
+
+	int dl_core = scheduler::get().reserve_bandwidth(tcb_.affinity, was_deadline ? tcb_.dl_core : -1, old_bandwidth, new_bandwidth);
+	if (dl_core < 0) {
+		return deadline_result::over_subscribed;
+	}
+
+	// The parameters can't be changed while the thread is queued, so take it off the run queue first.
+	bool queued = state_ == thread_states::runnable || state_ == thread_states::running;
+	if (queued) {
+		scheduler::get().remove_from_schedule(*this);
+	}
+
+	tcb_.dl_runtime = runtime;
+	tcb_.dl_deadline = deadline;
+	tcb_.dl_period = period;
+
+	// The first period starts when the thread is next queued.
+	tcb_.dl_abs_deadline = 0;
+	tcb_.dl_budget = 0;
+	tcb_.dl_charged = tcb_.run_time;
+	tcb_.rt_priority = 0;
+	tcb_.policy = sched_policy::deadline;
+	tcb_.dl_core = dl_core;
+
+	if (queued) {
+		scheduler::get().add_to_schedule(*this);
+
+		// A thread that is running elsewhere is moved to its reserved core once it is switched away from.
+		core *running_on = ((volatile tcb *)&tcb_)->running_on;
+		if (running_on && running_on->id() != dl_core) {
+			running_on->request_resched();
+		}
+	}
+
+	return deadline_result::ok;
+}
+
+/**
+ * Places a thread that has been taken off the run queue of a core it may no longer run on, now that the core has
+ * switched away from it (see core::schedule).  The thread may have blocked or been stopped in the meantime, in which
+ * case it's left alone.
+ */
+void thread::finish_migration()
+{
+	unique_irq_lock l(state_lock_);
+
+	tcb_.migrating = false;
+
+	if ((state_ == thread_states::runnable || state_ == thread_states::running) && owning_core() == nullptr) {
+		scheduler::get().add_to_schedule(*this);
+	}
+}
+
+u64 thread::deadline_bandwidth() const { return bandwidth(tcb_.dl_runtime, tcb_.dl_period); }
+
 void thread::task_entry_trampoline(thread *thread)
 {
 	// If there is an entry point, then run it and stop the task once it has completed.
@@ -64,17 +340,21 @@ void thread::task_entry_trampoline(thread *thread)
 
 void thread::init_tcb()
 {
-	// Allocate an 8k stack.
-	kernel_stack_ = memory_manager::get().pgalloc().allocate_pages(stack_size_order, page_allocation_flags::zero);
+	// Allocate a kernel stack.  Its contents are undefined (it may have been used by a thread that has since
+	// terminated), so the initial machine context must be cleared.
+	kernel_stack_ = memory_manager::get().kstackalloc().allocate();
+	uintptr_t stack_top = (uintptr_t)kernel_stack_ + memory_manager::get().kstackalloc().stack_size();
 
 	// Set the pointer to the task object in the task control block, and pop the initial
 	// machine context into the stack.
 	tcb_.entity = this;
-	tcb_.mcontext = (machine_context *)(((uintptr_t)kernel_stack_->base_address_ptr() + stack_size) - sizeof(machine_context));
-	tcb_.cr3 = owner_.addrspace().pgtable().effective_cr3();
-	tcb_.kernel_stack = (u64)kernel_stack_->base_address_ptr() + stack_size;
+	tcb_.mcontext = (machine_context *)(stack_top - sizeof(machine_context));
+	tcb_.cr3 = owner_.addrspace().pgtable().effective_cr3() | owner_.addrspace().asid();
+	tcb_.kernel_stack = (u64)stack_top;
 	tcb_.user_stack_save = 0;
 
+	memops::bzero(tcb_.mcontext, sizeof(machine_context));
+
 	// Fill in the required values for starting this task in the initial context.
 
 	if (owner_.privilege() == exec_privilege::kernel) {
@@ -96,7 +376,7 @@ void thread::init_tcb()
 		tcb_.mcontext->rdi = (u64)this; // The first argument to the trampoline is a pointer to this task object.
 
 		// The stack pointer needs to point to the allocated stack.
-		tcb_.mcontext->rsp = (u64)((uintptr_t)kernel_stack_->base_address_ptr() + stack_size);
+		tcb_.mcontext->rsp = (u64)stack_top;
 
 		// The GS register needs to point to the TCB, so that the kernel thread can manipulate itself.
 		tcb_.mcontext->gs = (u64)&tcb_;
@@ -107,81 +387,98 @@ void thread::init_tcb()
 	}
 }
 
-void thread::change_state(thread_states new_state)
+/**
+ * Moves this thread into a new state, and returns false if the state didn't actually change.
+ */
+bool thread::change_state(thread_states new_state)
 {
-	// Ignore threads whose state isn't actually changing (unless the state
-	// is "created")
-	if (state_ == new_state && state_ != thread_states::created) {
-		return;
-	}
+	{
+		// The state may be changed concurrently by other cores (e.g. a thread being woken up on one
+		// core, while it is still going to sleep on another), so changes must be serialised.
+		unique_irq_lock l(state_lock_);
+
+		// Ignore threads whose state isn't actually changing (unless the state
+		// is "created")
+		if (state_ == new_state && state_ != thread_states::created) {
+			return false;
+		}
 
-	switch (new_state) {
-	case thread_states::created: // thread is newly created
-		switch (state_) {
-		case thread_states::created:
-			state_ = new_state;
+		switch (new_state) {
+		case thread_states::created: // thread is newly created
+			switch (state_) {
+			case thread_states::created:
+				state_ = new_state;
+				break;
+
+			default:
+				panic("illegal thread state change");
+			}
 			break;
 
-		default:
-			panic("illegal thread state change");
-		}
-		break;
-
-	case thread_states::runnable: // thread is becoming runnable
-		switch (state_) {
-		case thread_states::created:
-		case thread_states::running:
-		case thread_states::suspended:
-			state_ = new_state;
-			scheduler::get().add_to_schedule(*this);
+		case thread_states::runnable: // thread is becoming runnable
+			switch (state_) {
+			case thread_states::terminated: // a terminated thread can't be woken up again
+				return false;
+
+			case thread_states::created:
+			case thread_states::running:
+			case thread_states::suspended:
+				state_ = new_state;
+				tcb_.wakeup_time = __builtin_ia32_rdtsc();
+				scheduler::get().add_to_schedule(*this);
+				break;
+
+			default:
+				panic("illegal thread state change");
+			}
 			break;
 
-		default:
-			panic("illegal thread state change");
-		}
-		break;
+		case thread_states::running: // thread is running on a core
+			switch (state_) {
+			case thread_states::runnable:
+				state_ = new_state;
+				break;
 
-	case thread_states::running: // thread is running on a core
-		switch (state_) {
-		case thread_states::runnable:
-			state_ = new_state;
+			default:
+				panic("illegal thread state change");
+			}
 			break;
 
-		default:
-			panic("illegal thread state change");
-		}
-		break;
+		case thread_states::suspended: // thread is going to sleep
+			switch (state_) {
+			case thread_states::runnable:
+			case thread_states::running:
+				state_ = new_state;
+				scheduler::get().remove_from_schedule(*this);
+				break;
 
-	case thread_states::suspended: // thread is going to sleep
-		switch (state_) {
-		case thread_states::runnable:
-		case thread_states::running:
-			state_ = new_state;
-			scheduler::get().remove_from_schedule(*this);
+			default:
+				panic("illegal thread state change");
+			}
 			break;
 
-		default:
-			panic("illegal thread state change");
-		}
-		break;
-
-	case thread_states::terminated: // thread has been terminated
-		switch (state_) {
-		case thread_states::runnable:
-		case thread_states::running:
-		case thread_states::suspended:
-			state_ = new_state;
-			scheduler::get().remove_from_schedule(*this);
+		case thread_states::terminated: // thread has been terminated
+			switch (state_) {
+			case thread_states::runnable:
+			case thread_states::running:
+			case thread_states::suspended:
+				state_ = new_state;
+				scheduler::get().remove_from_schedule(*this);
+				break;
+
+			default:
+				panic("illegal thread state change");
+			}
 			break;
 
 		default:
 			panic("illegal thread state change");
 		}
-		break;
+	}
 
-	default:
-		panic("illegal thread state change");
+	if (new_state == thread_states::terminated) {
+		join_queue_.wake_all();
 	}
 
-	state_changed_event_.trigger();
+	return true;
 }
@@ -0,0 +1,168 @@
+/* SPDX-License-Identifier: MIT */
+
+/* StACSOS - Kernel
+ *
+ * Copyright (c) University of St Andrews 2024
+ * Tom Spink <tcs6@st-andrews.ac.uk>
+ */
+#include <stacsos/kernel/arch/x86/x86-core.h>
+#include <stacsos/kernel/debug.h>
+#include <stacsos/kernel/sched/sleeper.h>
+#include <stacsos/kernel/sched/thread.h>
+#include <stacsos/kernel/sched/wait-queue.h>
+
+using namespace stacsos::kernel::sched;
+using namespace stacsos::kernel::arch::x86;
+
+/**
+ * Returns the TSC value that is the given number of microseconds from now.
+ */
+u64 wait_queue::deadline_after_us(u64 timeout_us)
+{
+	auto &tsc = x86_core::this_core().local_tsc();
+	return tsc.read() + ((timeout_us * tsc.frequency()) / 1000000);
+}
+
+/**
+ * Suspends the current thread, and queues it on the tail of this queue.  If there is a deadline, the
+ * thread's sleep timer is armed to wake it then.
+ */
+bool wait_queue::enqueue_current_locked(u64 key, u64 deadline)
+{
+	auto &tsc = x86_core::this_core().local_tsc();
+	if (deadline && tsc.read() >= deadline) {
+		return false;
+	}
+
+	thread &ct = thread::current();
+	wait_queue_entry &e = ct.wait_entry();
+
+	e.thr = &ct;
+	e.key = key;
+	e.next = nullptr;
+	e.prev = tail_;
+
+	if (tail_) {
+		tail_->next = &e;
+	} else {
+		head_ = &e;
+	}
+
+	tail_ = &e;
+	e.queue = this;
+	e.queued = true;
+
+	ct.suspend();
+
+	if (deadline) {
+		sleeper::get().arm(ct, deadline);
+	}
+
+	return true;
+}
+
+/**
+ * Switches away from the current thread, which must have been queued with enqueue_current_locked.
+ * Returns true if the thread was woken up by the queue, or false if it was woken up for some other
+ * reason (e.g. its timeout expired), in which case it is taken off the queue.
+ */
+bool wait_queue::block_current()
+{
+	thread &ct = thread::current();
+	x86_core::this_core().switch_to_next();
+
+	sleeper::get().cancel(ct);
+
+	unique_irq_lock l(lock_);
+
+	wait_queue_entry &e = ct.wait_entry();
+	if (e.queued) {
+		dequeue(e);
+		return false;
+	}
+
+	return true;
+}
+
+u64 wait_queue::wake_n(u64 n)
+{
+	unique_irq_lock l(lock_);
+	return wake_n_locked(n);
+}
+
+/**
+ * Wakes up to n threads from the head of the queue, and returns the number woken.
+ */
+u64 wait_queue::wake_n_locked(u64 n)
+{
+	u64 woken = 0;
+
+	while (head_ && woken < n) {
+		wait_queue_entry *e = head_;
+		dequeue(*e);
+
+		e->thr->resume();
+		woken++;
+	}
+
+	return woken;
+}
+
+/**
+ * Wakes up to n threads that were queued with the given key, in FIFO order, and returns the number
+ * woken.
+ */
+u64 wait_queue::wake_keyed_locked(u64 key, u64 n)
+{
+	u64 woken = 0;
+	wait_queue_entry *e = head_;
+
+	while (e && woken < n) {
+		wait_queue_entry *next = e->next;
+
+		if (e->key == key) {
+			dequeue(*e);
+
+			e->thr->resume();
+			woken++;
+		}
+
+		e = next;
+	}
+
+	return woken;
+}
+
+void wait_queue::dequeue(wait_queue_entry &e)
+{
+	if (e.prev) {
+		e.prev->next = e.next;
+	} else {
+		head_ = e.next;
+	}
+
+	if (e.next) {
+		e.next->prev = e.prev;
+	} else {
+		tail_ = e.prev;
+	}
+
+	e.next = e.prev = nullptr;
+	e.queue = nullptr;
+	e.queued = false;
+}
+
+void wait_queue::cancel(wait_queue_entry &e)
+{
+	wait_queue *q = __atomic_load_n(&e.queue, __ATOMIC_ACQUIRE);
+	if (!q) {
+		return;
+	}
+
+	unique_irq_lock l(q->lock_);
+
+	// The entry may have been woken up (or moved) in the meantime.
+	if (e.queued && e.queue == q) {
+		q->dequeue(e);
+	}
+}
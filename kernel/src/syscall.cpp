@@ -5,6 +5,8 @@
  * Copyright (c) University of St Andrews 2024
  * Tom Spink <tcs6@st-andrews.ac.uk>
  */
+#include <stacsos/kernel/arch/core-manager.h>
+#include <stacsos/kernel/arch/core.h>
 #include <stacsos/kernel/arch/x86/cregs.h>
 #include <stacsos/kernel/arch/x86/pio.h>
 #include <stacsos/kernel/debug.h>
@@ -14,6 +16,7 @@
 #include <stacsos/kernel/mem/address-space.h>
 #include <stacsos/kernel/obj/object-manager.h>
 #include <stacsos/kernel/obj/object.h>
+#include <stacsos/kernel/sched/futex.h>
 #include <stacsos/kernel/sched/process-manager.h>
 #include <stacsos/kernel/sched/process.h>
 #include <stacsos/kernel/sched/sleeper.h>
@@ -78,7 +81,8 @@ static syscall_result do_get_dir_contents(const char *path,char *buffer,size_t b
 		//ensure there is enough space for one more dirent 
         if (offset + sizeof(dirent) > buffer_size) return { syscall_result_code::buffer_overflow, offset };
 
-        dirent e {};
+        dirent e;
+        memops::bzero(&e, sizeof(e));
 
 		//copy file name, type and size into dirent
         size_t len = child->name().length();
@@ -119,7 +123,7 @@ static syscall_result operation_result_to_syscall_result(operation_result &&o)
 	return syscall_result { rc, o.data };
 }
 
-extern "C" syscall_result handle_syscall(syscall_numbers index, u64 arg0, u64 arg1, u64 arg2, u64 arg3)
+static syscall_result dispatch_syscall(syscall_numbers index, u64 arg0, u64 arg1, u64 arg2, u64 arg3)
 {
 	// dprintf("\nHandle syscall entered: %llu \n", static_cast<u64>(index));
 	
@@ -130,6 +134,9 @@ extern "C" syscall_result handle_syscall(syscall_numbers index, u64 arg0, u64 ar
 	switch (index) {
 	case syscall_numbers::exit:
 		current_process.stop();
+
+		// The process is about to be torn down, so it mustn't return to user mode.
+		stacsos::kernel::arch::core::this_core().switch_to_next();
 		return syscall_result { syscall_result_code::ok, 0 };
 
 	case syscall_numbers::set_fs:
@@ -137,7 +144,9 @@ extern "C" syscall_result handle_syscall(syscall_numbers index, u64 arg0, u64 ar
 		return syscall_result { syscall_result_code::ok, 0 };
 
 	case syscall_numbers::set_gs:
-		stacsos::kernel::arch::x86::gsbase::write(arg0);
+		// The active GS base belongs to the kernel during a system call (see syscall_entry), so the
+		// user's one has to be updated instead.
+		stacsos::kernel::arch::x86::user_gsbase::write(arg0);
 		return syscall_result { syscall_result_code::ok, 0 };
 
 	case syscall_numbers::open:
@@ -174,6 +183,15 @@ extern "C" syscall_result handle_syscall(syscall_numbers index, u64 arg0, u64 ar
 		return operation_result_to_syscall_result(o->read((void *)arg1, arg2));
 	}
 
+	case syscall_numbers::try_read: {
+		auto o = object_manager::get().get_object(current_process, arg0);
+		if (!o) {
+			return syscall_result { syscall_result_code::not_found, 0 };
+		}
+
+		return operation_result_to_syscall_result(o->try_read((void *)arg1, arg2));
+	}
+
 	case syscall_numbers::pread: {
 		auto o = object_manager::get().get_object(current_process, arg0);
 		if (!o) {
@@ -230,7 +248,7 @@ extern "C" syscall_result handle_syscall(syscall_numbers index, u64 arg0, u64 ar
 
 	case syscall_numbers::stop_current_thread: {
 		current_thread.stop();
-		asm volatile("int $0xff");
+		stacsos::kernel::arch::core::this_core().switch_to_next();
 
 		return syscall_result { syscall_result_code::ok, 0 };
 	}
@@ -244,6 +262,87 @@ extern "C" syscall_result handle_syscall(syscall_numbers index, u64 arg0, u64 ar
 		return operation_result_to_syscall_result(thread_object->join());
 	}
 
+	case syscall_numbers::set_thread_policy: {
+		// A thread id of zero refers to the calling thread.
+		if (arg0 == 0) {
+			if (!current_thread.set_sched_policy((sched_policy)arg1, (u32)arg2)) {
+				return syscall_result { syscall_result_code::invalid_argument, 0 };
+			}
+
+			return syscall_result { syscall_result_code::ok, 0 };
+		}
+
+		auto thread_object = object_manager::get().get_object(current_process, arg0);
+		if (!thread_object) {
+			return syscall_result { syscall_result_code::not_found, 0 };
+		}
+
+		return operation_result_to_syscall_result(thread_object->set_sched_policy(arg1, arg2));
+	}
+
+	case syscall_numbers::set_thread_deadline: {
+		// A thread id of zero refers to the calling thread.
+		if (arg0 == 0) {
+			switch (current_thread.set_deadline(arg1, arg2, arg3)) {
+			case deadline_result::ok:
+				return syscall_result { syscall_result_code::ok, 0 };
+			case deadline_result::over_subscribed:
+				return syscall_result { syscall_result_code::over_subscribed, 0 };
+			default:
+				return syscall_result { syscall_result_code::invalid_argument, 0 };
+			}
+		}
+
+		auto thread_object = object_manager::get().get_object(current_process, arg0);
+		if (!thread_object) {
+			return syscall_result { syscall_result_code::not_found, 0 };
+		}
+
+		return operation_result_to_syscall_result(thread_object->set_deadline(arg1, arg2, arg3));
+	}
+
+	case syscall_numbers::set_thread_affinity: {
+		// A thread id of zero refers to the calling thread.
+		if (arg0 == 0) {
+			if (!current_thread.set_affinity(arg1)) {
+				return syscall_result { syscall_result_code::invalid_argument, 0 };
+			}
+
+			return syscall_result { syscall_result_code::ok, 0 };
+		}
+
+		auto thread_object = object_manager::get().get_object(current_process, arg0);
+		if (!thread_object) {
+			return syscall_result { syscall_result_code::not_found, 0 };
+		}
+
+		return operation_result_to_syscall_result(thread_object->set_affinity(arg1));
+	}
+
+	case syscall_numbers::futex_wait:
+		switch (futex::get().wait(current_process, arg0, (u32)arg1, arg2)) {
+		case futex_result::ok:
+			return syscall_result { syscall_result_code::ok, 0 };
+		case futex_result::would_block:
+			return syscall_result { syscall_result_code::would_block, 0 };
+		case futex_result::timed_out:
+			return syscall_result { syscall_result_code::timed_out, 0 };
+		default:
+			return syscall_result { syscall_result_code::invalid_argument, 0 };
+		}
+
+	case syscall_numbers::futex_wake: {
+		u64 nr_woken;
+		if (futex::get().wake(current_process, arg0, arg1, nr_woken) != futex_result::ok) {
+			return syscall_result { syscall_result_code::invalid_argument, 0 };
+		}
+
+		return syscall_result { syscall_result_code::ok, nr_woken };
+	}
+
+	case syscall_numbers::get_nr_cores:
+		return syscall_result { syscall_result_code::ok, (u64)stacsos::kernel::arch::core_manager::get().nr_cores() };
+
 	case syscall_numbers::sleep: {
 		sleeper::get().sleep_ms(arg0);
 		return syscall_result { syscall_result_code::ok, 0 };
@@ -267,3 +366,17 @@ extern "C" syscall_result handle_syscall(syscall_numbers index, u64 arg0, u64 ar
 		return syscall_result { syscall_result_code::not_supported, 0 };
 	}
 }
+
+extern "C" syscall_result handle_syscall(syscall_numbers index, u64 arg0, u64 arg1, u64 arg2, u64 arg3)
+{
+	syscall_result result = dispatch_syscall(index, arg0, arg1, arg2, arg3);
+
+	// A system call that woke up a more important task on this core can't kick the core, so the reschedule is
+	// picked up here, before returning to user mode.
+	auto &c = stacsos::kernel::arch::core::this_core();
+	if (c.resched_pending()) {
+		c.switch_to_next();
+	}
+
+	return result;
+}
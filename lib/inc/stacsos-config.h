@@ -1,3 +1,12 @@
 #pragma once
 
-#define USE_FSGSBASE
+/*
+ * The kernel spinlock implementation.  Exactly one of these should be defined:
+ *   SPINLOCK_TAS    - test-and-test-and-set (smallest, but unfair)
+ *   SPINLOCK_TICKET - ticket lock (FIFO, spins on a shared word)
+ *   SPINLOCK_MCS    - MCS queue lock (FIFO, each waiter spins on its own cache line)
+ */
+#define SPINLOCK_TICKET
+
+// Count acquisitions, and contended acquisitions, of each kernel spinlock.
+#define SPINLOCK_STATS
@@ -129,8 +129,23 @@ public:
 	{
 	}
 
+	~avl_tree() { do_clear(root_); }
+
 	void add(const K &key, const D &data) { root_ = do_insert(root_, key, data); }
 
+	/**
+	 * @brief Removes the entry with the given key (if there is one), optionally returning its data.  Returns false
+	 * if there was no such entry.
+	 */
+	bool remove(const K &key, D *data = nullptr)
+	{
+		bool removed = false;
+		root_ = do_remove(root_, key, data, removed);
+		return removed;
+	}
+
+	bool empty() const { return root_ == nullptr; }
+
 	bool try_get_value(const K &key, D &data)
 	{
 		node *ref = root_;
@@ -193,7 +208,7 @@ private:
 	{
 		int bf = ref->balance_factor();
 		if (bf > 1) {
-			if (ref->left()->balance_factor() > 0) {
+			if (ref->left()->balance_factor() >= 0) {
 				return ll_rot(ref);
 			} else {
 				return lr_rot(ref);
@@ -221,5 +236,60 @@ private:
 			return balance(ref);
 		}
 	}
+
+	node *do_remove(node *ref, const K &key, D *data, bool &removed)
+	{
+		if (ref == nullptr) {
+			return nullptr;
+		} else if (ref->key() == key) {
+			if (data) {
+				*data = ref->data();
+			}
+
+			removed = true;
+
+			node *replacement;
+			if (ref->left() == nullptr) {
+				replacement = ref->right();
+			} else if (ref->right() == nullptr) {
+				replacement = ref->left();
+			} else {
+				// Replace the node with the smallest node in its right subtree.
+				node *right = detach_min(ref->right(), replacement);
+				replacement->left(ref->left());
+				replacement->right(right);
+				replacement = balance(replacement);
+			}
+
+			delete ref;
+			return replacement;
+		} else if (key < ref->key()) {
+			ref->left(do_remove(ref->left(), key, data, removed));
+			return balance(ref);
+		} else {
+			ref->right(do_remove(ref->right(), key, data, removed));
+			return balance(ref);
+		}
+	}
+
+	node *detach_min(node *ref, node *&min)
+	{
+		if (ref->left() == nullptr) {
+			min = ref;
+			return ref->right();
+		}
+
+		ref->left(detach_min(ref->left(), min));
+		return balance(ref);
+	}
+
+	void do_clear(node *ref)
+	{
+		if (ref) {
+			do_clear(ref->left());
+			do_clear(ref->right());
+			delete ref;
+		}
+	}
 };
 } // namespace stacsos
@@ -134,9 +134,8 @@ public:
 
 	shared_ptr<T> &operator=(shared_ptr<T> other)
 	{
+		// The copy has already taken a reference, and the old one is dropped when the copy is destroyed.
 		swap(*this, other);
-
-		acquire();
 		return *this;
 	}
 
@@ -161,6 +160,9 @@ public:
 
 	T *get(void) const { return ptr_; }
 
+	bool operator==(const shared_ptr<T> &other) const { return ptr_ == other.ptr_; }
+	bool operator!=(const shared_ptr<T> &other) const { return ptr_ != other.ptr_; }
+
 	friend void swap(shared_ptr &a, shared_ptr &b) noexcept
 	{
 		swap(a.ptr_, b.ptr_);
@@ -171,17 +173,19 @@ private:
 	void acquire()
 	{
 		if (refcount_ == nullptr) {
-			refcount_ = new u64(1);
+			// Copies of an empty pointer stay empty.
+			if (ptr_ != nullptr) {
+				refcount_ = new u64(1);
+			}
 		} else {
-			(*refcount_)++;
+			__atomic_add_fetch(refcount_, 1, __ATOMIC_RELAXED);
 		}
 	}
 
 	void release()
 	{
 		if (refcount_ != nullptr) {
-			(*refcount_)--;
-			if (*refcount_ == 0) {
+			if (__atomic_sub_fetch(refcount_, 1, __ATOMIC_ACQ_REL) == 0) {
 				if (ptr_ != nullptr) {
 					(void)sizeof(T);
 					delete ptr_;
@@ -0,0 +1,31 @@
+/* SPDX-License-Identifier: MIT */
+
+/* StACSOS - Utility Library
+ *
+ * Copyright (c) University of St Andrews 2024
+ * Tom Spink <tcs6@st-andrews.ac.uk>
+ */
+#pragma once
+
+namespace stacsos {
+/**
+ * Thread scheduling policies.  The normal, batch and interactive policies are scheduled by the fair
+ * scheduling algorithm, and differ only in the length of their time slices.  The real-time policies
+ * have a static priority, and always run in preference to the fair policies.  Deadline tasks are
+ * periodic, with a runtime budget in each period, and run in preference to everything else.
+ */
+enum class sched_policy : u32 {
+	normal = 0,
+	batch = 1,
+	interactive = 2,
+	rt_fifo = 3,
+	rt_rr = 4,
+	deadline = 5,
+	nr_policies
+};
+
+// Real-time priorities run from 0 to max_rt_priority, where higher numbers are more important.
+static const u32 max_rt_priority = 63;
+
+static inline bool is_rt_policy(sched_policy p) { return p == sched_policy::rt_fifo || p == sched_policy::rt_rr; }
+} // namespace stacsos
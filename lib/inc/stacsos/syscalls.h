@@ -13,7 +13,10 @@ enum class syscall_result_code : u64 {
 	not_found = 1, 
 	not_supported = 2, 
 	buffer_overflow = 3, 
-	invalid_argument = 4
+	invalid_argument = 4,
+	over_subscribed = 5,
+	would_block = 6,
+	timed_out = 7
 };
 
 enum class syscall_numbers {
@@ -35,7 +38,14 @@ enum class syscall_numbers {
 	sleep = 15,
 	poweroff = 16,
 	ioctl = 17, 
-	get_dir_contents = 18
+	get_dir_contents = 18,
+	set_thread_policy = 19,
+	set_thread_deadline = 20,
+	set_thread_affinity = 21,
+	futex_wait = 22,
+	futex_wake = 23,
+	try_read = 24,
+	get_nr_cores = 25
 
 };
 
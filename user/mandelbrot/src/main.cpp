@@ -15,10 +15,9 @@
  * A program that prints a rather crude version of the Mandelbrot fractal to the StACSOS terminal.
  */
 
-#include <stacsos/atomic.h>
 #include <stacsos/console.h>
 #include <stacsos/objects.h>
-#include <stacsos/threads.h>
+#include <stacsos/thread-pool.h>
 
 using namespace stacsos;
 
@@ -51,12 +50,6 @@ const u32 WIDTH = 80; // frame is 80x25
 const u32 HEIGHT = 25;
 const u32 LAST_PIXEL = WIDTH * HEIGHT;
 
-//#define WORKLIST
-
-#ifdef WORKLIST
-atomic<u32> next_pixel = 0;
-#endif
-
 object *fb;
 
 static void drawchar(int x, int y, int attr, unsigned char c)
@@ -96,25 +89,9 @@ void output(int value, int i, int j)
 	}
 }
 
-#ifndef WORKLIST
-struct thread_data {
-	u32 start_pixel, end_pixel;
-};
-#endif
-
-static void *mandelbrot(void *arg)
+static void mandelbrot(u32 start_pixel, u32 end_pixel)
 {
-#ifndef WORKLIST
-	thread_data *data = (thread_data *)arg;
-	u32 my_pixel = data->start_pixel;
-
-	while (my_pixel < data->end_pixel) {
-#else
-	u32 my_pixel = next_pixel++;
-
-	while (my_pixel < LAST_PIXEL) {
-#endif
-
+	for (u32 my_pixel = start_pixel; my_pixel < end_pixel; my_pixel++) {
 		int x = my_pixel % WIDTH;
 		int y = my_pixel / WIDTH;
 
@@ -138,15 +115,7 @@ static void *mandelbrot(void *arg)
 		}
 
 		output(count, y, x);
-
-#ifdef WORKLIST
-		my_pixel = next_pixel++;
-#else
-		my_pixel++;
-#endif
 	}
-
-	return nullptr;
 }
 
 int main(const char *cmdline)
@@ -158,14 +127,6 @@ int main(const char *cmdline)
 		return 1;
 	}
 
-	const int NUM_THREADS = 8;
-
-	thread *threads[NUM_THREADS];
-
-#ifndef WORKLIST
-	thread_data thread_data[NUM_THREADS];
-#endif
-
 	realMin = -2 * NORM_FACT;
 	realMax = 1 * NORM_FACT;
 	imagMin = -1 * NORM_FACT;
@@ -174,25 +135,11 @@ int main(const char *cmdline)
 	deltaReal = (realMax - realMin) / (WIDTH - 1);
 	deltaImag = (imagMax - imagMin) / (HEIGHT - 1);
 
-	const u32 CHUNK_SIZE = LAST_PIXEL / NUM_THREADS;
-
-	for (int thread_index = 0; thread_index < NUM_THREADS; thread_index++) {
-#ifndef WORKLIST
-		thread_data[thread_index].start_pixel = thread_index * CHUNK_SIZE;
-		thread_data[thread_index].end_pixel = thread_data[thread_index].start_pixel + CHUNK_SIZE;
-		if (thread_data[thread_index].end_pixel > LAST_PIXEL) {
-			thread_data[thread_index].end_pixel = LAST_PIXEL;
-		}
-
-		threads[thread_index] = thread::start(mandelbrot, &thread_data[thread_index]);
-#else
-		threads[thread_index] = thread::start(mandelbrot, nullptr);
-#endif
-	}
+	// Work is shared out a few pixels at a time, so that the workers that get the cheap parts of the image
+	// can help out with the expensive parts.
+	const u32 CHUNK_SIZE = 16;
 
-	for (int k = 0; k < NUM_THREADS; k++) {
-		threads[k]->join();
-	}
+	parallel_for(thread_pool::get(), 0, LAST_PIXEL, CHUNK_SIZE, [](u64 start_pixel, u64 end_pixel) { mandelbrot(start_pixel, end_pixel); });
 
 	// wait for input so the prompt doesn't ruin the lovely image
 	// remove this when timing!
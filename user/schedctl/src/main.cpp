@@ -0,0 +1,50 @@
+/* SPDX-License-Identifier: MIT */
+
+/* StACSOS - schedctl utility, for switching scheduling algorithms at runtime.
+ *
+ * Copyright (c) University of St Andrews 2024, 2025
+ * Tom Spink <tcs6@st-andrews.ac.uk>
+ */
+#include <stacsos/console.h>
+#include <stacsos/memops.h>
+#include <stacsos/objects.h>
+
+using namespace stacsos;
+
+int main(const char *cmdline)
+{
+	object *ctl = object::open("/dev/schedctl0");
+	if (!ctl) {
+		console::get().write("error: unable to open scheduler control device\n");
+		return 1;
+	}
+
+	// With an argument, i.e. "[core] <algorithm>", switch algorithms first.
+	if (cmdline && memops::strlen(cmdline) > 0) {
+		if (ctl->write(cmdline, memops::strlen(cmdline)) == 0) {
+			console::get().write("error: usage: schedctl [[core] sfs|cfs]\n");
+			delete ctl;
+			return 1;
+		}
+
+		// Re-open the device, to see the new state.
+		delete ctl;
+		ctl = object::open("/dev/schedctl0");
+		if (!ctl) {
+			return 1;
+		}
+	}
+
+	char buffer[64];
+	int bytes_read;
+
+	do {
+		bytes_read = ctl->read(buffer, sizeof(buffer) - 1);
+		buffer[bytes_read] = 0;
+
+		console::get().writef("%s", buffer);
+	} while (bytes_read > 0);
+
+	delete ctl;
+	return 0;
+}
@@ -0,0 +1,241 @@
+/* SPDX-License-Identifier: MIT */
+
+/* StACSOS - userspace standard library
+ *
+ * Copyright (c) University of St Andrews 2024
+ * Tom Spink <tcs6@st-andrews.ac.uk>
+ */
+#pragma once
+
+#include <stacsos/helpers.h>
+#include <stacsos/sync.h>
+
+namespace stacsos {
+/*
+ * Fibers are lightweight threads, which are scheduled cooperatively, entirely in user mode.  Each
+ * kernel thread that runs a fiber_scheduler has its own run queue of fibers, and switching between
+ * them is just a matter of swapping the callee-saved registers and the stack pointer.  A fiber is a
+ * small stack (with the fiber object itself at the top of it), and stacks are recycled, so creating a
+ * fiber needs neither a system call nor a heap allocation once the scheduler has warmed up.
+ *
+ * Fibers run until they finish, yield, or would block reading from an object, so a fiber that never
+ * does any of these holds up the others on its scheduler.  When every fiber on a scheduler is waiting
+ * to read, the scheduler's thread blocks in the kernel on the first fiber's read (so a fiber spawned
+ * from another thread only starts once that read completes).  A fiber_pool spreads fibers over several
+ * kernel threads (i.e. M:N threading).
+ */
+
+class object;
+class fiber_scheduler;
+
+class fiber {
+	friend class fiber_scheduler;
+
+public:
+	virtual ~fiber() { }
+
+	/**
+	 * Returns the fiber that is running on the calling thread, or nullptr if the thread isn't running one.
+	 */
+	static fiber *current();
+
+	/**
+	 * Lets the other runnable fibers on this thread's scheduler run, before carrying on.  Outside of a
+	 * fiber, this does nothing.
+	 */
+	static void yield();
+
+	/**
+	 * Reads from the object, parking the fiber (so that other fibers can run) for as long as the read
+	 * would block.  If no fiber can run, the scheduler blocks in the kernel to complete the read.  Outside
+	 * of a fiber, the read just blocks as normal.
+	 */
+	static size_t read(object &o, void *buffer, size_t length);
+
+protected:
+	fiber()
+		: saved_rsp_(0)
+		, scheduler_(nullptr)
+		, next_(nullptr)
+		, stack_(nullptr)
+		, read_(nullptr)
+		, finished_(false)
+	{
+	}
+
+	virtual void run() = 0;
+
+private:
+	// A read that a parked fiber is waiting for, which lives on the fiber's stack.
+	struct pending_read {
+		object *obj;
+		void *buffer;
+		size_t length;
+		size_t result;
+	};
+
+	u64 saved_rsp_;
+	fiber_scheduler *scheduler_;
+	fiber *next_;
+	void *stack_;
+	pending_read *read_;
+	bool finished_;
+
+	friend void fiber_entry(fiber *f);
+};
+
+template <class F> class function_fiber : public fiber {
+public:
+	template <class G>
+	function_fiber(G &&fn)
+		: fn_(forward<G>(fn))
+	{
+	}
+
+protected:
+	virtual void run() override { fn_(); }
+
+private:
+	F fn_;
+};
+
+class fiber_scheduler {
+	friend class fiber;
+	friend void fiber_entry(fiber *f);
+
+public:
+	// The size of each fiber's stack, including the fiber object (and whatever it captures).
+	static const size_t default_stack_size = 16 * 1024;
+	static const size_t min_stack_size = 8 * 1024;
+
+	explicit fiber_scheduler(size_t stack_size = default_stack_size);
+	~fiber_scheduler();
+
+	/**
+	 * Returns the scheduler that is running on the calling thread, or nullptr.
+	 */
+	static fiber_scheduler *current();
+
+	/**
+	 * Creates a fiber that runs the function.  Fibers can be spawned from any thread; fibers spawned
+	 * by other threads are picked up by the thread running this scheduler.  Returns false if there is
+	 * no memory for the fiber's stack.
+	 */
+	template <class F>
+		requires requires(F fn) { fn(); }
+	bool spawn(F &&fn)
+	{
+		using fiber_type = function_fiber<remove_reference_type<F>>;
+		static_assert(sizeof(fiber_type) <= min_stack_size / 4, "fiber function captures too much state");
+
+		void *stack = allocate_stack();
+		if (!stack) {
+			return false;
+		}
+
+		fiber *f = new (fiber_slot(stack, sizeof(fiber_type))) fiber_type(forward<F>(fn));
+		f->stack_ = stack;
+
+		start(f);
+		return true;
+	}
+
+	/**
+	 * Runs fibers on the calling thread, until every fiber spawned on this scheduler has finished.
+	 */
+	void run() { run_loop(false); }
+
+	/**
+	 * Runs fibers on the calling thread, and waits for more to be spawned when there are none, until
+	 * stop() is called.
+	 */
+	void serve() { run_loop(true); }
+	void stop();
+
+	/**
+	 * Blocks until every fiber spawned on this scheduler has finished.  The scheduler must be running on
+	 * another thread.
+	 */
+	void wait_idle();
+
+	u32 nr_live() const { return __atomic_load_n(&live_, __ATOMIC_ACQUIRE); }
+
+private:
+	size_t stack_size_;
+
+	// The context of the scheduler loop, while a fiber is running.
+	u64 saved_rsp_;
+	fiber *current_;
+
+	// Runnable fibers, which are only touched by the thread running the scheduler.
+	fiber *run_head_, *run_tail_;
+
+	// Fibers that are parked until their reads can complete, which are also only touched by the thread
+	// running the scheduler.  These are polled when there's nothing else to run, and every so often
+	// otherwise, so that fibers that keep yielding can't starve them.
+	static const u32 reader_poll_interval = 64;
+	fiber *readers_head_, *readers_tail_;
+	u32 switches_since_poll_;
+
+	// Fibers spawned by other threads.
+	mutex remote_lock_;
+	fiber *remote_head_, *remote_tail_;
+	u32 remote_seq_;
+	u32 sleeping_;
+
+	// The number of fibers that have been spawned, but not finished.
+	u32 live_;
+	bool stopping_;
+
+	// Stacks of finished fibers, linked through their first word.
+	mutex stack_lock_;
+	void *free_stacks_;
+
+	void *allocate_stack();
+	void free_stack(void *stack);
+	void *fiber_slot(void *stack, size_t size) const;
+
+	void start(fiber *f);
+	void enqueue(fiber *f);
+	fiber *dequeue();
+	void take_remote();
+	void park_reader(fiber *f);
+	void poll_readers();
+	void complete_read_blocking();
+
+	void run_loop(bool serve);
+	void switch_to(fiber *f);
+	void switch_to_scheduler(fiber *f);
+};
+
+/**
+ * Runs fibers over a fixed number of kernel threads, each with its own scheduler.  New fibers are
+ * handed to the schedulers in turn.
+ */
+class fiber_pool {
+public:
+	explicit fiber_pool(u32 nr_threads, size_t stack_size = fiber_scheduler::default_stack_size);
+	~fiber_pool();
+
+	template <class F>
+		requires requires(F fn) { fn(); }
+	bool spawn(F &&fn)
+	{
+		u32 next = __atomic_fetch_add(&next_, 1, __ATOMIC_RELAXED);
+		return schedulers_[next % nr_threads_]->spawn(forward<F>(fn));
+	}
+
+	/**
+	 * Blocks until every fiber spawned on the pool has finished.
+	 */
+	void wait();
+
+private:
+	u32 nr_threads_;
+	u32 next_;
+	fiber_scheduler **schedulers_;
+	class thread **threads_;
+
+	static void *thread_main(void *arg);
+};
+} // namespace stacsos
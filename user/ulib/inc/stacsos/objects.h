@@ -18,6 +18,10 @@ public:
 	size_t pwrite(const void *buffer, size_t length, size_t offset);
 
 	size_t read(void *buffer, size_t length);
+
+	// Reads whatever is available (up to length bytes) without blocking.  Returns false if the read would
+	// have blocked.
+	bool try_read(void *buffer, size_t length, size_t &bytes_read);
 	size_t pread(void *buffer, size_t length, size_t offset);
 
 	u64 ioctl(u64 cmd, void *buffer, size_t length);
@@ -0,0 +1,120 @@
+/* SPDX-License-Identifier: MIT */
+
+/* StACSOS - userspace standard library
+ *
+ * Copyright (c) University of St Andrews 2024
+ * Tom Spink <tcs6@st-andrews.ac.uk>
+ */
+#pragma once
+
+namespace stacsos {
+/*
+ * Synchronisation primitives for userspace threads.  These are all built on futexes: the uncontended
+ * paths are a handful of atomic instructions, contended threads spin for a short while in the hope
+ * that the holder is about to finish, and only then block in the kernel.
+ */
+
+class mutex {
+public:
+	mutex()
+		: state_(unlocked)
+	{
+	}
+
+	void lock();
+	bool try_lock();
+	void unlock();
+
+private:
+	friend class condition_variable;
+
+	// The mutex is "contended" if there may be threads blocked on it, in which case unlock has to wake one.
+	enum : u32 { unlocked = 0, locked = 1, contended = 2 };
+
+	u32 state_;
+
+	void lock_contended();
+};
+
+class condition_variable {
+public:
+	condition_variable()
+		: seq_(0)
+		, waiters_(0)
+	{
+	}
+
+	void wait(mutex &m);
+	void notify_one();
+	void notify_all();
+
+private:
+	u32 seq_;
+	u32 waiters_;
+};
+
+class semaphore {
+public:
+	explicit semaphore(u32 initial_count)
+		: count_(initial_count)
+		, waiters_(0)
+	{
+	}
+
+	void acquire();
+	bool try_acquire();
+	void release(u32 n = 1);
+
+private:
+	u32 count_;
+	u32 waiters_;
+};
+
+class rwlock {
+public:
+	rwlock()
+		: state_(0)
+		, waiters_(0)
+	{
+	}
+
+	void read_lock();
+	bool try_read_lock();
+	void read_unlock();
+
+	void write_lock();
+	bool try_write_lock();
+	void write_unlock();
+
+private:
+	// The state holds the number of readers, or the writer bit if a writer holds the lock.
+	static const u32 writer = 1u << 31;
+
+	u32 state_;
+	u32 waiters_;
+
+	void wait_for_change(u32 observed);
+	void wake_waiters();
+};
+
+class barrier {
+public:
+	explicit barrier(u32 nr_threads)
+		: nr_threads_(nr_threads)
+		, arrived_(0)
+		, generation_(0)
+	{
+	}
+
+	/**
+	 * Blocks until nr_threads threads have arrived at the barrier.  Returns true in exactly one of the
+	 * threads released in each round.
+	 */
+	bool arrive_and_wait();
+
+private:
+	u32 nr_threads_;
+	u32 arrived_;
+	u32 generation_;
+};
+} // namespace stacsos
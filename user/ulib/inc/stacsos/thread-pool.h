@@ -0,0 +1,257 @@
+/* SPDX-License-Identifier: MIT */
+
+/* StACSOS - userspace standard library
+ *
+ * Copyright (c) University of St Andrews 2024
+ * Tom Spink <tcs6@st-andrews.ac.uk>
+ */
+#pragma once
+
+#include <stacsos/helpers.h>
+#include <stacsos/sync.h>
+
+namespace stacsos {
+/*
+ * A work-stealing thread pool.  The pool has a fixed set of worker threads, each of which owns a
+ * Chase-Lev deque of tasks.  Tasks spawned by a worker are pushed onto (and popped from) the bottom
+ * of its own deque, without any locking, and idle workers steal from the top of other workers' deques,
+ * so load is balanced dynamically.  Tasks spawned from outside the pool go onto a shared queue.
+ *
+ * Threads that wait for tasks to finish (see task_group::wait) help out by running queued tasks in
+ * the meantime, so nested parallelism doesn't tie up workers.
+ */
+
+class task_group;
+class thread_pool;
+
+class task {
+	friend class task_group;
+	friend class thread_pool;
+
+public:
+	task()
+		: group_(nullptr)
+		, next_(nullptr)
+		, owned_(false)
+	{
+	}
+
+	virtual ~task() { }
+
+	virtual void run() = 0;
+
+private:
+	task_group *group_;
+	task *next_;
+	bool owned_;
+};
+
+template <class F> class function_task : public task {
+public:
+	template <class G>
+	function_task(G &&fn)
+		: fn_(forward<G>(fn))
+	{
+	}
+
+	virtual void run() override { fn_(); }
+
+private:
+	F fn_;
+};
+
+class thread_pool {
+	friend class task_group;
+
+public:
+	/**
+	 * Creates a pool with the given number of workers, or with one worker per online core if that is zero.
+	 */
+	explicit thread_pool(u32 nr_workers = 0);
+	~thread_pool();
+
+	/**
+	 * Returns the process-wide pool, which is created (with one worker per online core) when it is first
+	 * used.
+	 */
+	static thread_pool &get();
+
+	u32 nr_workers() const { return nr_workers_; }
+
+	// Tasks created from function objects are carved out of blocks of this size, which the pool hands
+	// out to task groups, and takes back (for reuse) once the groups have finished with them.
+	static const size_t task_block_size = 0x1000;
+	static const size_t task_block_header_size = 16;
+
+private:
+	struct worker;
+
+	u32 nr_workers_;
+	worker **workers_;
+
+	// Tasks submitted from threads that aren't workers in this pool.
+	mutex inject_lock_;
+	task *inject_head_, *inject_tail_;
+
+	// Bumped whenever work is made available, so that idle workers can sleep on it.
+	u32 work_seq_;
+	u32 sleepers_;
+	u32 next_victim_;
+	bool stopping_;
+
+	// Blocks returned by task groups, linked through their first word.
+	mutex block_lock_;
+	void *free_blocks_;
+
+	worker *current_worker();
+	void *allocate_block();
+	void free_blocks(void *head);
+
+	void spawn(task &t);
+	task *find_task(worker *self);
+	void execute(task &t);
+
+	static void *worker_main(void *arg);
+};
+
+/**
+ * A set of tasks that can be waited for together.  Tasks can either be owned by the caller (and must
+ * then stay alive until wait() returns), or created from a function object, in which case they live in
+ * storage that belongs to the group until wait() returns.
+ */
+class task_group {
+	friend class thread_pool;
+
+public:
+	explicit task_group(thread_pool &pool = thread_pool::get())
+		: pool_(pool)
+		, pending_(0)
+		, started_(0)
+		, done_(0)
+		, block_(nullptr)
+		, block_used_(0)
+	{
+	}
+
+	~task_group() { wait(); }
+
+	void run(task &t);
+
+	template <class F>
+		requires requires(F fn) { fn(); }
+	void run(F &&fn)
+	{
+		using task_type = function_task<remove_reference_type<F>>;
+		static_assert(sizeof(task_type) <= (thread_pool::task_block_size - thread_pool::task_block_header_size) / 4,
+			"task function captures too much state");
+
+		void *storage = allocate_task(sizeof(task_type));
+		if (!storage) {
+			// There's no memory for the task, so just run the function here.
+			fn();
+			return;
+		}
+
+		task *t = new (storage) task_type(forward<F>(fn));
+		t->owned_ = true;
+
+		run(*t);
+	}
+
+	/**
+	 * Blocks until every task in the group has finished, running queued tasks from the pool while
+	 * waiting.
+	 */
+	void wait();
+
+private:
+	thread_pool &pool_;
+	u32 pending_;
+
+	// The number of times pending_ has gone up from, and back down to, zero.  The worker that brings
+	// pending_ down to zero still has to wake the waiters, so wait() doesn't return (and let the group
+	// go out of scope) until that worker has bumped done_ to say it's finished with the group.
+	u32 started_;
+	u32 done_;
+
+	// The block that function tasks are being carved out of, which is linked to the group's earlier
+	// (full) blocks through its first word.
+	mutex block_lock_;
+	u8 *block_;
+	size_t block_used_;
+
+	void *allocate_task(size_t size);
+	void release_tasks();
+	void finished();
+};
+
+namespace detail {
+template <class F> class range_task : public task {
+public:
+	range_task(thread_pool &pool, u64 begin, u64 end, u64 grain, const F &fn)
+		: pool_(pool)
+		, begin_(begin)
+		, end_(end)
+		, grain_(grain)
+		, fn_(fn)
+	{
+	}
+
+	virtual void run() override;
+
+private:
+	thread_pool &pool_;
+	u64 begin_, end_, grain_;
+	const F &fn_;
+};
+
+/*
+ * Splits the range in half until the pieces are no bigger than the grain size, leaving the upper halves
+ * for other workers to steal.  The tasks for the upper halves live on the stack, as this frame waits
+ * for them before returning.
+ */
+template <class F> void split_range(thread_pool &pool, u64 begin, u64 end, u64 grain, const F &fn)
+{
+	if (end - begin <= grain) {
+		fn(begin, end);
+		return;
+	}
+
+	u64 mid = begin + ((end - begin) / 2);
+
+	range_task<F> upper(pool, mid, end, grain, fn);
+	task_group group(pool);
+
+	group.run(upper);
+	split_range(pool, begin, mid, grain, fn);
+	group.wait();
+}
+
+template <class F> void range_task<F>::run() { split_range(pool_, begin_, end_, grain_, fn_); }
+} // namespace detail
+
+/**
+ * Calls fn(chunk_begin, chunk_end) for chunks of at most grain elements that together cover
+ * [begin, end), in parallel, and returns when every chunk has been processed.
+ */
+template <class F> void parallel_for(thread_pool &pool, u64 begin, u64 end, u64 grain, const F &fn)
+{
+	if (begin >= end) {
+		return;
+	}
+
+	detail::split_range(pool, begin, end, grain ? grain : 1, fn);
+}
+
+/**
+ * As above, on the process-wide pool, with a grain size that gives each worker several chunks to share
+ * out.
+ */
+template <class F> void parallel_for(u64 begin, u64 end, const F &fn)
+{
+	thread_pool &pool = thread_pool::get();
+
+	u64 grain = end > begin ? (end - begin) / (pool.nr_workers() * 8) : 1;
+	parallel_for(pool, begin, end, grain, fn);
+}
+} // namespace stacsos
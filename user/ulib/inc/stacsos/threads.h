@@ -7,13 +7,20 @@
  */
 #pragma once
 
+#include <stacsos/sched-policy.h>
+#include <stacsos/syscalls.h>
+
 namespace stacsos {
 typedef void *(*thread_entry_fn)(void *);
 
+// Pointers that are private to each thread, which ulib's runtimes use to find their per-thread state.
+enum class thread_local_slot : u32 { pool_worker = 0, fiber_scheduler = 1, nr_slots = 4 };
+
 struct thread_context {
 	thread_entry_fn ep_;
 	void *arg_;
 	void *result_;
+	void *local_[(u32)thread_local_slot::nr_slots];
 };
 
 class thread {
@@ -24,6 +31,28 @@ public:
 
 	void *join();
 
+	bool set_policy(sched_policy policy, u32 priority = 0);
+	static bool set_current_policy(sched_policy policy, u32 priority = 0);
+
+	// Makes the thread a periodic deadline task, which runs for runtime_us in every period_us, within
+	// deadline_us of the start of each period (or by the end of the period, if deadline_us is zero).
+	syscall_result_code set_deadline(u64 runtime_us, u64 deadline_us, u64 period_us);
+	static syscall_result_code set_current_deadline(u64 runtime_us, u64 deadline_us, u64 period_us);
+
+	// Restricts the thread to the cores in the mask, where bit n represents core n.
+	bool set_affinity(u64 core_mask);
+	static bool set_current_affinity(u64 core_mask);
+
+	// Accesses the current thread's pointer in the given slot, which is initially null.
+	static void *local(thread_local_slot slot)
+	{
+		void *v;
+		asm volatile("mov %%fs:(,%1,8), %0" : "=r"(v) : "r"((u64)slot));
+		return v;
+	}
+
+	static void set_local(thread_local_slot slot, void *v) { asm volatile("mov %0, %%fs:(,%1,8)" : : "r"(v), "r"((u64)slot) : "memory"); }
+
 private:
 	thread(u64 handle, thread_context *tc)
 		: handle_(handle)
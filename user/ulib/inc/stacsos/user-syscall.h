@@ -9,6 +9,7 @@
 
 #include <stacsos/syscalls.h>
 #include <stacsos/dirent.h>
+#include <stacsos/sched-policy.h>
 #include <stacsos/console.h>
 
 namespace stacsos {
@@ -48,6 +49,12 @@ public:
 		return rw_result { r.code, r.data };
 	}
 
+	static rw_result try_read(u64 object, void *buffer, u64 length)
+	{
+		auto r = syscall3(syscall_numbers::try_read, object, (u64)buffer, length);
+		return rw_result { r.code, r.data };
+	}
+
 	static rw_result write(u64 object, const void *buffer, u64 length)
 	{
 		auto r = syscall3(syscall_numbers::write, object, (u64)buffer, length);
@@ -84,8 +91,24 @@ public:
 	static syscall_result start_thread(void *entrypoint, void *arg) { return syscall2(syscall_numbers::start_thread, (u64)entrypoint, (u64)arg); }
 	static syscall_result join_thread(u64 id) { return syscall1(syscall_numbers::join_thread, id); }
 	static syscall_result stop_current_thread() { return syscall0(syscall_numbers::stop_current_thread); }
+	static syscall_result set_thread_policy(u64 id, sched_policy policy, u32 priority)
+	{
+		return syscall3(syscall_numbers::set_thread_policy, id, (u64)policy, priority);
+	}
+	static syscall_result set_thread_deadline(u64 id, u64 runtime_us, u64 deadline_us, u64 period_us)
+	{
+		return syscall4(syscall_numbers::set_thread_deadline, id, runtime_us, deadline_us, period_us);
+	}
+	static syscall_result set_thread_affinity(u64 id, u64 mask) { return syscall2(syscall_numbers::set_thread_affinity, id, mask); }
+
+	static syscall_result_code futex_wait(const volatile u32 *addr, u32 expected, u64 timeout_us = 0)
+	{
+		return syscall3(syscall_numbers::futex_wait, (u64)addr, expected, timeout_us).code;
+	}
+	static syscall_result futex_wake(const volatile u32 *addr, u64 count) { return syscall2(syscall_numbers::futex_wake, (u64)addr, count); }
 
 	static syscall_result sleep(u64 ms) { return syscall1(syscall_numbers::sleep, ms); }
+	static syscall_result get_nr_cores() { return syscall0(syscall_numbers::get_nr_cores); }
 
 	static void poweroff() { syscall0(syscall_numbers::poweroff); }
 
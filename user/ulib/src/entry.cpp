@@ -13,6 +13,7 @@ using namespace stacsos;
 
 extern int main(const char *cmdline);
 
+// The first few words are the main thread's thread-local pointers (see thread::local).
 static char tls[256];
 
 static void init_tls() { stacsos::syscalls::set_fs((u64)tls); }
@@ -0,0 +1,452 @@
+/* SPDX-License-Identifier: MIT */
+
+/* StACSOS - userspace standard library
+ *
+ * Copyright (c) University of St Andrews 2024
+ * Tom Spink <tcs6@st-andrews.ac.uk>
+ */
+#include <stacsos/fiber.h>
+#include <stacsos/objects.h>
+#include <stacsos/threads.h>
+#include <stacsos/user-syscall.h>
+
+using namespace stacsos;
+
+extern "C" void fiber_switch(u64 *save_rsp, u64 new_rsp);
+extern "C" void fiber_trampoline();
+
+static inline u32 load(const u32 &v) { return __atomic_load_n(&v, __ATOMIC_SEQ_CST); }
+
+namespace stacsos {
+/**
+ * Where every fiber starts (via fiber_trampoline), on its own stack.  Once the fiber has run, it
+ * switches back to the scheduler for the last time, which then frees it.
+ */
+void fiber_entry(fiber *f)
+{
+	f->run();
+
+	f->finished_ = true;
+	f->scheduler_->switch_to_scheduler(f);
+
+	__unreachable();
+}
+} // namespace stacsos
+
+extern "C" void fiber_entry_proc(fiber *f) { fiber_entry(f); }
+
+/*
+ * Fiber
+ */
+
+fiber *fiber::current()
+{
+	fiber_scheduler *s = fiber_scheduler::current();
+	return s ? s->current_ : nullptr;
+}
+
+void fiber::yield()
+{
+	fiber *f = current();
+	if (!f) {
+		return;
+	}
+
+	f->scheduler_->enqueue(f);
+	f->scheduler_->switch_to_scheduler(f);
+}
+
+size_t fiber::read(object &o, void *buffer, size_t length)
+{
+	size_t n;
+	if (o.try_read(buffer, length, n)) {
+		return n;
+	}
+
+	fiber *f = current();
+	if (!f) {
+		return o.read(buffer, length);
+	}
+
+	// Park until the scheduler has completed the read on our behalf.
+	pending_read r { &o, buffer, length, 0 };
+	f->read_ = &r;
+
+	f->scheduler_->park_reader(f);
+	f->scheduler_->switch_to_scheduler(f);
+
+	f->read_ = nullptr;
+	return r.result;
+}
+
+/*
+ * Fiber Scheduler
+ */
+
+fiber_scheduler::fiber_scheduler(size_t stack_size)
+	: stack_size_(PAGE_ALIGN_UP(stack_size > min_stack_size ? stack_size : min_stack_size))
+	, saved_rsp_(0)
+	, current_(nullptr)
+	, run_head_(nullptr)
+	, run_tail_(nullptr)
+	, readers_head_(nullptr)
+	, readers_tail_(nullptr)
+	, switches_since_poll_(0)
+	, remote_head_(nullptr)
+	, remote_tail_(nullptr)
+	, remote_seq_(0)
+	, sleeping_(0)
+	, live_(0)
+	, stopping_(false)
+	, free_stacks_(nullptr)
+{
+}
+
+fiber_scheduler::~fiber_scheduler()
+{
+	// Stacks come straight from the kernel, which has no way of giving memory back, so the cached ones
+	// are simply dropped.
+}
+
+fiber_scheduler *fiber_scheduler::current() { return (fiber_scheduler *)thread::local(thread_local_slot::fiber_scheduler); }
+
+void *fiber_scheduler::allocate_stack()
+{
+	stack_lock_.lock();
+
+	void *stack = free_stacks_;
+	if (stack) {
+		free_stacks_ = *(void **)stack;
+	}
+
+	stack_lock_.unlock();
+
+	if (!stack) {
+		auto r = syscalls::alloc_mem(stack_size_);
+		if (r.code != syscall_result_code::ok) {
+			return nullptr;
+		}
+
+		stack = r.ptr;
+	}
+
+	return stack;
+}
+
+void fiber_scheduler::free_stack(void *stack)
+{
+	stack_lock_.lock();
+
+	*(void **)stack = free_stacks_;
+	free_stacks_ = stack;
+
+	stack_lock_.unlock();
+}
+
+/**
+ * Returns where a fiber object of the given size goes in a stack: right at the top, so that the stack
+ * itself grows down from just below it.
+ */
+void *fiber_scheduler::fiber_slot(void *stack, size_t size) const { return (void *)(((u64)stack + stack_size_ - size) & ~15ull); }
+
+/**
+ * Prepares a new fiber's stack so that the first switch to it lands in fiber_trampoline, and queues it.
+ */
+void fiber_scheduler::start(fiber *f)
+{
+	f->scheduler_ = this;
+
+	// This must match the frame that fiber_switch pops: r15, r14, r13, r12, rbx, rbp, then the return
+	// address.  The fiber object is 16-byte aligned, so the stack is correctly aligned once the return
+	// address has been popped.
+	u64 *sp = (u64 *)f;
+	*--sp = (u64)fiber_trampoline;
+	*--sp = 0; // rbp
+	*--sp = 0; // rbx
+	*--sp = (u64)f; // r12
+	*--sp = 0; // r13
+	*--sp = 0; // r14
+	*--sp = 0; // r15
+
+	f->saved_rsp_ = (u64)sp;
+
+	__atomic_fetch_add(&live_, 1, __ATOMIC_SEQ_CST);
+
+	if (current() == this) {
+		enqueue(f);
+		return;
+	}
+
+	remote_lock_.lock();
+
+	if (remote_tail_) {
+		remote_tail_->next_ = f;
+	} else {
+		remote_head_ = f;
+	}
+
+	remote_tail_ = f;
+
+	remote_lock_.unlock();
+
+	// The scheduler either sees the fiber before it sleeps, or the change in the sequence number when
+	// it tries to.
+	__atomic_fetch_add(&remote_seq_, 1, __ATOMIC_SEQ_CST);
+	if (load(sleeping_)) {
+		syscalls::futex_wake(&remote_seq_, 1);
+	}
+}
+
+void fiber_scheduler::enqueue(fiber *f)
+{
+	f->next_ = nullptr;
+
+	if (run_tail_) {
+		run_tail_->next_ = f;
+	} else {
+		run_head_ = f;
+	}
+
+	run_tail_ = f;
+}
+
+fiber *fiber_scheduler::dequeue()
+{
+	fiber *f = run_head_;
+
+	if (f) {
+		run_head_ = f->next_;
+		if (!run_head_) {
+			run_tail_ = nullptr;
+		}
+	}
+
+	return f;
+}
+
+/**
+ * Moves any fibers spawned by other threads onto the run queue.
+ */
+void fiber_scheduler::take_remote()
+{
+	if (!__atomic_load_n(&remote_head_, __ATOMIC_RELAXED)) {
+		return;
+	}
+
+	remote_lock_.lock();
+
+	fiber *head = remote_head_, *tail = remote_tail_;
+	remote_head_ = remote_tail_ = nullptr;
+
+	remote_lock_.unlock();
+
+	if (!head) {
+		return;
+	}
+
+	if (run_tail_) {
+		run_tail_->next_ = head;
+	} else {
+		run_head_ = head;
+	}
+
+	run_tail_ = tail;
+}
+
+void fiber_scheduler::park_reader(fiber *f)
+{
+	f->next_ = nullptr;
+
+	if (readers_tail_) {
+		readers_tail_->next_ = f;
+	} else {
+		readers_head_ = f;
+	}
+
+	readers_tail_ = f;
+}
+
+/**
+ * Retries the parked fibers' reads without blocking, and makes the fibers whose reads completed runnable.
+ */
+void fiber_scheduler::poll_readers()
+{
+	fiber *f = readers_head_;
+	readers_head_ = readers_tail_ = nullptr;
+
+	while (f) {
+		fiber *next = f->next_;
+		fiber::pending_read *r = f->read_;
+
+		if (r->obj->try_read(r->buffer, r->length, r->result)) {
+			enqueue(f);
+		} else {
+			park_reader(f);
+		}
+
+		f = next;
+	}
+}
+
+/**
+ * Completes the first parked fiber's read by blocking in the kernel, for when no fiber can run.
+ */
+void fiber_scheduler::complete_read_blocking()
+{
+	fiber *f = readers_head_;
+
+	readers_head_ = f->next_;
+	if (!readers_head_) {
+		readers_tail_ = nullptr;
+	}
+
+	fiber::pending_read *r = f->read_;
+	r->result = r->obj->read(r->buffer, r->length);
+
+	enqueue(f);
+}
+
+void fiber_scheduler::stop()
+{
+	__atomic_store_n(&stopping_, true, __ATOMIC_SEQ_CST);
+	__atomic_fetch_add(&remote_seq_, 1, __ATOMIC_SEQ_CST);
+
+	syscalls::futex_wake(&remote_seq_, 1);
+}
+
+void fiber_scheduler::wait_idle()
+{
+	while (u32 live = load(live_)) {
+		syscalls::futex_wait(&live_, live);
+	}
+}
+
+void fiber_scheduler::run_loop(bool serve)
+{
+	void *outer = thread::local(thread_local_slot::fiber_scheduler);
+	thread::set_local(thread_local_slot::fiber_scheduler, this);
+
+	while (true) {
+		take_remote();
+
+		if (readers_head_ && (!run_head_ || ++switches_since_poll_ >= reader_poll_interval)) {
+			switches_since_poll_ = 0;
+			poll_readers();
+		}
+
+		fiber *f = dequeue();
+		if (f) {
+			switch_to(f);
+			continue;
+		}
+
+		// Every fiber is waiting for input, so there's nothing to do but wait for some.
+		if (readers_head_) {
+			complete_read_blocking();
+			continue;
+		}
+
+		if (serve ? __atomic_load_n(&stopping_, __ATOMIC_SEQ_CST) : load(live_) == 0) {
+			break;
+		}
+
+		// Nothing to run, so wait for a fiber to be spawned from another thread.  Announce that we're
+		// going to sleep before checking one last time, so that a spawn after the check wakes us up.
+		u32 seq = load(remote_seq_);
+		__atomic_store_n(&sleeping_, 1, __ATOMIC_SEQ_CST);
+
+		if (!__atomic_load_n(&remote_head_, __ATOMIC_SEQ_CST) && !__atomic_load_n(&stopping_, __ATOMIC_SEQ_CST)) {
+			syscalls::futex_wait(&remote_seq_, seq);
+		}
+
+		__atomic_store_n(&sleeping_, 0, __ATOMIC_SEQ_CST);
+	}
+
+	thread::set_local(thread_local_slot::fiber_scheduler, outer);
+}
+
+/**
+ * Runs the fiber until it yields or finishes, and frees it if it has finished.
+ */
+void fiber_scheduler::switch_to(fiber *f)
+{
+	current_ = f;
+	fiber_switch(&saved_rsp_, f->saved_rsp_);
+	current_ = nullptr;
+
+	if (f->finished_) {
+		void *stack = f->stack_;
+
+		// The fiber object lives on its own stack, which is no longer in use.
+		f->~fiber();
+		free_stack(stack);
+
+		if (__atomic_sub_fetch(&live_, 1, __ATOMIC_SEQ_CST) == 0) {
+			syscalls::futex_wake(&live_, ~0ull);
+		}
+	}
+}
+
+void fiber_scheduler::switch_to_scheduler(fiber *f) { fiber_switch(&f->saved_rsp_, saved_rsp_); }
+
+/*
+ * Fiber Pool
+ */
+
+fiber_pool::fiber_pool(u32 nr_threads, size_t stack_size)
+	: nr_threads_(nr_threads ? nr_threads : 1)
+	, next_(0)
+	, schedulers_(new fiber_scheduler *[nr_threads_])
+	, threads_(new thread *[nr_threads_])
+{
+	for (u32 i = 0; i < nr_threads_; i++) {
+		schedulers_[i] = new fiber_scheduler(stack_size);
+	}
+
+	for (u32 i = 0; i < nr_threads_; i++) {
+		threads_[i] = thread::start(thread_main, schedulers_[i]);
+	}
+}
+
+fiber_pool::~fiber_pool()
+{
+	wait();
+
+	for (u32 i = 0; i < nr_threads_; i++) {
+		schedulers_[i]->stop();
+
+		if (threads_[i]) {
+			threads_[i]->join();
+			delete threads_[i];
+		}
+
+		delete schedulers_[i];
+	}
+
+	delete[] threads_;
+	delete[] schedulers_;
+}
+
+void fiber_pool::wait()
+{
+	// Fibers may spawn more fibers on schedulers that have already been waited for, so keep going until
+	// every scheduler is found to be idle in the same pass.
+	bool idle;
+
+	do {
+		idle = true;
+
+		for (u32 i = 0; i < nr_threads_; i++) {
+			if (schedulers_[i]->nr_live()) {
+				idle = false;
+				schedulers_[i]->wait_idle();
+			}
+		}
+	} while (!idle);
+}
+
+void *fiber_pool::thread_main(void *arg)
+{
+	((fiber_scheduler *)arg)->serve();
+	return nullptr;
+}
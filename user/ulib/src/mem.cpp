@@ -5,6 +5,7 @@
  * Copyright (c) University of St Andrews 2024
  * Tom Spink <tcs6@st-andrews.ac.uk>
  */
+#include <stacsos/sync.h>
 #include <stacsos/user-syscall.h>
 
 extern "C" {
@@ -26,6 +27,8 @@ struct memory_block {
 				*slot = this->next;
 				return;
 			}
+
+			slot = &(*slot)->next;
 		}
 	}
 
@@ -55,7 +58,10 @@ struct memory_block {
 	void *ptr() { return (void *)((u64)this + sizeof(this)); }
 };
 
-static void *allocate(size_t size)
+// The free list is shared by every thread in the process.
+static stacsos::mutex allocator_lock;
+
+static void *allocate_locked(size_t size)
 {
 	memory_block *candidate_block = free_list;
 
@@ -93,6 +99,15 @@ static void *allocate(size_t size)
 	return candidate_block->ptr();
 }
 
+static void *allocate(size_t size)
+{
+	allocator_lock.lock();
+	void *p = allocate_locked(size);
+	allocator_lock.unlock();
+
+	return p;
+}
+
 void free(void *ptr)
 {
 	//
@@ -27,3 +27,11 @@ size_t object::write(const void *buffer, size_t length) { return syscalls::write
 size_t object::pwrite(const void *buffer, size_t length, size_t offset) { return syscalls::pwrite(handle_, buffer, length, offset).length; }
 size_t object::pread(void *buffer, size_t length, size_t offset) { return syscalls::pread(handle_, buffer, length, offset).length; }
 u64 object::ioctl(u64 cmd, void *buffer, size_t length) { return syscalls::ioctl(handle_, cmd, buffer, length).length; }
+
+bool object::try_read(void *buffer, size_t length, size_t &bytes_read)
+{
+	auto r = syscalls::try_read(handle_, buffer, length);
+	bytes_read = r.length;
+
+	return r.code != syscall_result_code::would_block;
+}
@@ -0,0 +1,276 @@
+/* SPDX-License-Identifier: MIT */
+
+/* StACSOS - userspace standard library
+ *
+ * Copyright (c) University of St Andrews 2024
+ * Tom Spink <tcs6@st-andrews.ac.uk>
+ */
+#include <stacsos/sync.h>
+#include <stacsos/user-syscall.h>
+
+using namespace stacsos;
+
+// The number of times to poll a lock before blocking in the kernel.
+static const int spin_limit = 100;
+
+static inline u32 load(const u32 &v) { return __atomic_load_n(&v, __ATOMIC_ACQUIRE); }
+
+static inline bool compare_exchange(u32 &v, u32 expected, u32 desired)
+{
+	return __atomic_compare_exchange_n(&v, &expected, desired, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+}
+
+static inline void wake_all(const u32 &v) { syscalls::futex_wake(&v, ~0ull); }
+
+/*
+ * Mutex
+ */
+
+void mutex::lock()
+{
+	if (compare_exchange(state_, unlocked, locked)) {
+		return;
+	}
+
+	// Spin for a while, in case the holder is about to release the mutex, before blocking.
+	for (int i = 0; i < spin_limit; i++) {
+		if (load(state_) == unlocked && compare_exchange(state_, unlocked, locked)) {
+			return;
+		}
+
+		__relax();
+	}
+
+	lock_contended();
+}
+
+bool mutex::try_lock() { return compare_exchange(state_, unlocked, locked); }
+
+/**
+ * The slow path for acquiring the mutex: mark it as contended, and block until it is released.  Once
+ * we've marked the mutex as contended, we can't tell whether there are other waiters, so we must hold
+ * on to the contended state when we do acquire it, so that our unlock wakes them.
+ */
+void mutex::lock_contended()
+{
+	while (__atomic_exchange_n(&state_, (u32)contended, __ATOMIC_ACQ_REL) != unlocked) {
+		syscalls::futex_wait(&state_, contended);
+	}
+}
+
+void mutex::unlock()
+{
+	if (__atomic_exchange_n(&state_, (u32)unlocked, __ATOMIC_RELEASE) == contended) {
+		syscalls::futex_wake(&state_, 1);
+	}
+}
+
+/*
+ * Condition Variable
+ */
+
+void condition_variable::wait(mutex &m)
+{
+	// Take a snapshot of the sequence number before releasing the mutex, so that a notification
+	// between the unlock and the wait isn't missed: the futex wait will fail, because the sequence
+	// number will have changed.
+	u32 seq = load(seq_);
+	__atomic_fetch_add(&waiters_, 1, __ATOMIC_ACQ_REL);
+
+	m.unlock();
+	syscalls::futex_wait(&seq_, seq);
+
+	__atomic_fetch_sub(&waiters_, 1, __ATOMIC_ACQ_REL);
+
+	// Other threads may have been woken along with us, so the mutex must be re-acquired as contended.
+	m.lock_contended();
+}
+
+void condition_variable::notify_one()
+{
+	__atomic_fetch_add(&seq_, 1, __ATOMIC_ACQ_REL);
+
+	if (load(waiters_)) {
+		syscalls::futex_wake(&seq_, 1);
+	}
+}
+
+void condition_variable::notify_all()
+{
+	__atomic_fetch_add(&seq_, 1, __ATOMIC_ACQ_REL);
+
+	if (load(waiters_)) {
+		wake_all(seq_);
+	}
+}
+
+/*
+ * Semaphore
+ */
+
+bool semaphore::try_acquire()
+{
+	u32 count = load(count_);
+
+	while (count > 0) {
+		if (__atomic_compare_exchange_n(&count_, &count, count - 1, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void semaphore::acquire()
+{
+	for (int i = 0; i < spin_limit; i++) {
+		if (try_acquire()) {
+			return;
+		}
+
+		__relax();
+	}
+
+	__atomic_fetch_add(&waiters_, 1, __ATOMIC_ACQ_REL);
+
+	while (!try_acquire()) {
+		syscalls::futex_wait(&count_, 0);
+	}
+
+	__atomic_fetch_sub(&waiters_, 1, __ATOMIC_ACQ_REL);
+}
+
+void semaphore::release(u32 n)
+{
+	__atomic_fetch_add(&count_, n, __ATOMIC_ACQ_REL);
+
+	if (load(waiters_)) {
+		syscalls::futex_wake(&count_, n);
+	}
+}
+
+/*
+ * Reader/Writer Lock
+ */
+
+bool rwlock::try_read_lock()
+{
+	u32 state = load(state_);
+	return !(state & writer) && compare_exchange(state_, state, state + 1);
+}
+
+void rwlock::read_lock()
+{
+	for (int i = 0; i < spin_limit; i++) {
+		if (try_read_lock()) {
+			return;
+		}
+
+		__relax();
+	}
+
+	while (true) {
+		u32 state = load(state_);
+
+		if (!(state & writer)) {
+			if (compare_exchange(state_, state, state + 1)) {
+				return;
+			}
+
+			continue;
+		}
+
+		wait_for_change(state);
+	}
+}
+
+void rwlock::read_unlock()
+{
+	// The last reader out lets any waiting writers in.
+	if (__atomic_sub_fetch(&state_, 1, __ATOMIC_RELEASE) == 0) {
+		wake_waiters();
+	}
+}
+
+bool rwlock::try_write_lock() { return compare_exchange(state_, 0, writer); }
+
+void rwlock::write_lock()
+{
+	for (int i = 0; i < spin_limit; i++) {
+		if (try_write_lock()) {
+			return;
+		}
+
+		__relax();
+	}
+
+	while (true) {
+		u32 state = load(state_);
+
+		if (state == 0) {
+			if (compare_exchange(state_, 0, writer)) {
+				return;
+			}
+
+			continue;
+		}
+
+		wait_for_change(state);
+	}
+}
+
+void rwlock::write_unlock()
+{
+	__atomic_store_n(&state_, 0, __ATOMIC_RELEASE);
+	wake_waiters();
+}
+
+/**
+ * Blocks until the lock state changes from the observed value.
+ */
+void rwlock::wait_for_change(u32 observed)
+{
+	__atomic_fetch_add(&waiters_, 1, __ATOMIC_ACQ_REL);
+	syscalls::futex_wait(&state_, observed);
+	__atomic_fetch_sub(&waiters_, 1, __ATOMIC_ACQ_REL);
+}
+
+void rwlock::wake_waiters()
+{
+	// Both readers and writers wait on the same word, so wake them all, and let them race for the lock.
+	if (load(waiters_)) {
+		wake_all(state_);
+	}
+}
+
+/*
+ * Barrier
+ */
+
+bool barrier::arrive_and_wait()
+{
+	u32 generation = load(generation_);
+
+	// The last thread to arrive resets the barrier for the next round, and releases everyone else.
+	if (__atomic_add_fetch(&arrived_, 1, __ATOMIC_ACQ_REL) == nr_threads_) {
+		__atomic_store_n(&arrived_, 0, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&generation_, 1, __ATOMIC_RELEASE);
+		wake_all(generation_);
+
+		return true;
+	}
+
+	for (int i = 0; i < spin_limit; i++) {
+		if (load(generation_) != generation) {
+			return false;
+		}
+
+		__relax();
+	}
+
+	while (load(generation_) == generation) {
+		syscalls::futex_wait(&generation_, generation);
+	}
+
+	return false;
+}
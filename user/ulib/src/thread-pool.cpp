@@ -0,0 +1,506 @@
+/* SPDX-License-Identifier: MIT */
+
+/* StACSOS - userspace standard library
+ *
+ * Copyright (c) University of St Andrews 2024
+ * Tom Spink <tcs6@st-andrews.ac.uk>
+ */
+#include <stacsos/thread-pool.h>
+#include <stacsos/threads.h>
+#include <stacsos/user-syscall.h>
+
+using namespace stacsos;
+
+// The number of times to look for work before sleeping (or blocking in a wait).
+static const int spin_limit = 100;
+
+static inline u32 load(const u32 &v) { return __atomic_load_n(&v, __ATOMIC_SEQ_CST); }
+
+/*
+ * Task Deque
+ */
+
+/**
+ * A Chase-Lev work-stealing deque.  Only the owning worker pushes and pops, at the bottom, and other
+ * threads steal from the top.  The owner only synchronises with thieves when the deque is down to its
+ * last task.  When the deque fills up, it's copied into a ring twice the size; old rings are kept until
+ * the deque is destroyed, as a thief may still be reading from one.
+ */
+class task_deque {
+public:
+	task_deque()
+		: top_(0)
+		, bottom_(0)
+		, ring_(new_ring(64))
+	{
+	}
+
+	~task_deque()
+	{
+		while (ring_) {
+			ring *r = ring_;
+			ring_ = r->retired;
+
+			delete[] r->slots;
+			delete r;
+		}
+	}
+
+	void push(task *t)
+	{
+		s64 b = __atomic_load_n(&bottom_, __ATOMIC_RELAXED);
+		s64 top = __atomic_load_n(&top_, __ATOMIC_ACQUIRE);
+		ring *r = __atomic_load_n(&ring_, __ATOMIC_RELAXED);
+
+		if (b - top > r->mask) {
+			r = grow(r, top, b);
+		}
+
+		__atomic_store_n(&r->slots[b & r->mask], t, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		__atomic_store_n(&bottom_, b + 1, __ATOMIC_RELAXED);
+	}
+
+	task *pop()
+	{
+		s64 b = __atomic_load_n(&bottom_, __ATOMIC_RELAXED) - 1;
+		ring *r = __atomic_load_n(&ring_, __ATOMIC_RELAXED);
+
+		__atomic_store_n(&bottom_, b, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+		s64 top = __atomic_load_n(&top_, __ATOMIC_RELAXED);
+		if (top > b) {
+			// Empty.
+			__atomic_store_n(&bottom_, b + 1, __ATOMIC_RELAXED);
+			return nullptr;
+		}
+
+		task *t = __atomic_load_n(&r->slots[b & r->mask], __ATOMIC_RELAXED);
+		if (top == b) {
+			// This is the last task, so race any thieves for it.
+			if (!__atomic_compare_exchange_n(&top_, &top, top + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+				t = nullptr;
+			}
+
+			__atomic_store_n(&bottom_, b + 1, __ATOMIC_RELAXED);
+		}
+
+		return t;
+	}
+
+	task *steal()
+	{
+		s64 top = __atomic_load_n(&top_, __ATOMIC_ACQUIRE);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		s64 b = __atomic_load_n(&bottom_, __ATOMIC_ACQUIRE);
+
+		if (top >= b) {
+			return nullptr;
+		}
+
+		ring *r = __atomic_load_n(&ring_, __ATOMIC_ACQUIRE);
+		task *t = __atomic_load_n(&r->slots[top & r->mask], __ATOMIC_RELAXED);
+
+		// Losing the race (to the owner, or another thief) just means trying somewhere else.
+		if (!__atomic_compare_exchange_n(&top_, &top, top + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+			return nullptr;
+		}
+
+		return t;
+	}
+
+private:
+	struct ring {
+		s64 mask;
+		task **slots;
+		ring *retired;
+	};
+
+	s64 top_, bottom_;
+	ring *ring_;
+
+	static ring *new_ring(s64 size) { return new ring { size - 1, new task *[size], nullptr }; }
+
+	ring *grow(ring *old, s64 top, s64 bottom)
+	{
+		ring *r = new_ring((old->mask + 1) * 2);
+
+		for (s64 i = top; i < bottom; i++) {
+			r->slots[i & r->mask] = old->slots[i & old->mask];
+		}
+
+		r->retired = old;
+		__atomic_store_n(&ring_, r, __ATOMIC_RELEASE);
+
+		return r;
+	}
+};
+
+/*
+ * Thread Pool
+ */
+
+struct thread_pool::worker {
+	thread_pool *pool;
+	u32 index;
+	u64 rng;
+	task_deque deque;
+	thread *handle;
+};
+
+/**
+ * Returns the number of cores that the kernel brought up, which is how many workers can run at once.
+ */
+static u32 online_cores()
+{
+	auto r = syscalls::get_nr_cores();
+	return (r.code == syscall_result_code::ok && r.data) ? (u32)r.data : 1;
+}
+
+thread_pool::thread_pool(u32 nr_workers)
+	: nr_workers_(nr_workers ? nr_workers : online_cores())
+	, workers_(new worker *[nr_workers_])
+	, inject_head_(nullptr)
+	, inject_tail_(nullptr)
+	, work_seq_(0)
+	, sleepers_(0)
+	, next_victim_(0)
+	, stopping_(false)
+	, free_blocks_(nullptr)
+{
+	// All the workers must exist before any of them start stealing from each other.
+	for (u32 i = 0; i < nr_workers_; i++) {
+		workers_[i] = new worker { this, i, i + 1, task_deque(), nullptr };
+	}
+
+	for (u32 i = 0; i < nr_workers_; i++) {
+		workers_[i]->handle = thread::start(worker_main, workers_[i]);
+	}
+}
+
+thread_pool::~thread_pool()
+{
+	__atomic_store_n(&stopping_, true, __ATOMIC_SEQ_CST);
+	__atomic_fetch_add(&work_seq_, 1, __ATOMIC_SEQ_CST);
+	syscalls::futex_wake(&work_seq_, ~0ull);
+
+	for (u32 i = 0; i < nr_workers_; i++) {
+		if (workers_[i]->handle) {
+			workers_[i]->handle->join();
+			delete workers_[i]->handle;
+		}
+
+		delete workers_[i];
+	}
+
+	delete[] workers_;
+}
+
+void *thread_pool::allocate_block()
+{
+	block_lock_.lock();
+
+	void *block = free_blocks_;
+	if (block) {
+		free_blocks_ = *(void **)block;
+	}
+
+	block_lock_.unlock();
+
+	if (!block) {
+		auto r = syscalls::alloc_mem(task_block_size);
+		if (r.code != syscall_result_code::ok) {
+			return nullptr;
+		}
+
+		block = r.ptr;
+	}
+
+	return block;
+}
+
+/**
+ * Takes back a chain of blocks, linked through their first word.  Memory can't be given back to the
+ * kernel, so the blocks are kept for the next groups that need them.
+ */
+void thread_pool::free_blocks(void *head)
+{
+	void *tail = head;
+	while (*(void **)tail) {
+		tail = *(void **)tail;
+	}
+
+	block_lock_.lock();
+
+	*(void **)tail = free_blocks_;
+	free_blocks_ = head;
+
+	block_lock_.unlock();
+}
+
+static thread_pool *default_pool;
+static mutex default_pool_lock;
+
+thread_pool &thread_pool::get()
+{
+	thread_pool *pool = __atomic_load_n(&default_pool, __ATOMIC_ACQUIRE);
+	if (pool) {
+		return *pool;
+	}
+
+	default_pool_lock.lock();
+
+	pool = default_pool;
+	if (!pool) {
+		pool = new thread_pool();
+		__atomic_store_n(&default_pool, pool, __ATOMIC_RELEASE);
+	}
+
+	default_pool_lock.unlock();
+
+	return *pool;
+}
+
+/**
+ * Returns the worker that the calling thread is, if it belongs to this pool, or nullptr.
+ */
+thread_pool::worker *thread_pool::current_worker()
+{
+	worker *w = (worker *)thread::local(thread_local_slot::pool_worker);
+	return (w && w->pool == this) ? w : nullptr;
+}
+
+void thread_pool::spawn(task &t)
+{
+	worker *self = current_worker();
+
+	if (self) {
+		self->deque.push(&t);
+	} else {
+		inject_lock_.lock();
+
+		t.next_ = nullptr;
+		if (inject_tail_) {
+			inject_tail_->next_ = &t;
+		} else {
+			inject_head_ = &t;
+		}
+
+		inject_tail_ = &t;
+
+		inject_lock_.unlock();
+	}
+
+	// Wake a sleeping worker to pick the task up.  A worker that is about to sleep will either see the
+	// task when it checks one last time, or the change in the sequence number when it tries to sleep.
+	__atomic_fetch_add(&work_seq_, 1, __ATOMIC_SEQ_CST);
+
+	if (load(sleepers_)) {
+		syscalls::futex_wake(&work_seq_, 1);
+	}
+}
+
+/**
+ * Finds a task to run, looking in the given worker's own deque first (if there is a worker), then
+ * trying to steal from the other workers, starting at a random one, and finally looking at the shared
+ * queue.
+ */
+task *thread_pool::find_task(worker *self)
+{
+	task *t;
+
+	if (self && (t = self->deque.pop())) {
+		return t;
+	}
+
+	u32 start;
+	if (self) {
+		self->rng ^= self->rng << 13;
+		self->rng ^= self->rng >> 7;
+		self->rng ^= self->rng << 17;
+
+		start = (u32)(self->rng % nr_workers_);
+	} else {
+		start = __atomic_fetch_add(&next_victim_, 1, __ATOMIC_RELAXED) % nr_workers_;
+	}
+
+	for (u32 i = 0; i < nr_workers_; i++) {
+		worker *victim = workers_[(start + i) % nr_workers_];
+
+		if (victim != self && (t = victim->deque.steal())) {
+			return t;
+		}
+	}
+
+	if (!__atomic_load_n(&inject_head_, __ATOMIC_RELAXED)) {
+		return nullptr;
+	}
+
+	inject_lock_.lock();
+
+	t = inject_head_;
+	if (t) {
+		inject_head_ = t->next_;
+		if (!inject_head_) {
+			inject_tail_ = nullptr;
+		}
+	}
+
+	inject_lock_.unlock();
+
+	return t;
+}
+
+void thread_pool::execute(task &t)
+{
+	// The group may be finished (and gone) as soon as it's told about the task, so the task must be
+	// dealt with first.
+	task_group *group = t.group_;
+
+	t.run();
+
+	// Owned tasks live in the group's storage, which is released once the group has finished.
+	if (t.owned_) {
+		t.~task();
+	}
+
+	group->finished();
+}
+
+void *thread_pool::worker_main(void *arg)
+{
+	worker *self = (worker *)arg;
+	thread_pool &pool = *self->pool;
+
+	thread::set_local(thread_local_slot::pool_worker, self);
+
+	while (!__atomic_load_n(&pool.stopping_, __ATOMIC_SEQ_CST)) {
+		task *t = nullptr;
+
+		for (int i = 0; i < spin_limit && !t; i++) {
+			if (!(t = pool.find_task(self))) {
+				__relax();
+			}
+		}
+
+		if (!t) {
+			// Register as a sleeper before the final check, so that anything spawned after the check
+			// wakes us up.
+			u32 seq = load(pool.work_seq_);
+			__atomic_fetch_add(&pool.sleepers_, 1, __ATOMIC_SEQ_CST);
+
+			t = pool.find_task(self);
+			if (!t && !__atomic_load_n(&pool.stopping_, __ATOMIC_SEQ_CST)) {
+				syscalls::futex_wait(&pool.work_seq_, seq);
+			}
+
+			__atomic_fetch_sub(&pool.sleepers_, 1, __ATOMIC_SEQ_CST);
+		}
+
+		if (t) {
+			pool.execute(*t);
+		}
+	}
+
+	return nullptr;
+}
+
+/*
+ * Task Group
+ */
+
+void task_group::run(task &t)
+{
+	t.group_ = this;
+
+	if (__atomic_fetch_add(&pending_, 1, __ATOMIC_SEQ_CST) == 0) {
+		__atomic_fetch_add(&started_, 1, __ATOMIC_SEQ_CST);
+	}
+
+	pool_.spawn(t);
+}
+
+/**
+ * Carves storage for a function task out of the group's current block, starting a new one if it's full.
+ * Returns nullptr if there's no memory for a new block.
+ */
+void *task_group::allocate_task(size_t size)
+{
+	size = (size + 15) & ~15ull;
+
+	block_lock_.lock();
+
+	if (!block_ || block_used_ + size > thread_pool::task_block_size) {
+		u8 *block = (u8 *)pool_.allocate_block();
+		if (!block) {
+			block_lock_.unlock();
+			return nullptr;
+		}
+
+		*(u8 **)block = block_;
+		block_ = block;
+		block_used_ = thread_pool::task_block_header_size;
+	}
+
+	void *storage = block_ + block_used_;
+	block_used_ += size;
+
+	block_lock_.unlock();
+
+	return storage;
+}
+
+/**
+ * Hands the group's blocks back to the pool.  This is only safe once every task in the group has finished.
+ */
+void task_group::release_tasks()
+{
+	if (!block_) {
+		return;
+	}
+
+	pool_.free_blocks(block_);
+
+	block_ = nullptr;
+	block_used_ = 0;
+}
+
+void task_group::finished()
+{
+	if (__atomic_sub_fetch(&pending_, 1, __ATOMIC_SEQ_CST) == 0) {
+		syscalls::futex_wake(&pending_, ~0ull);
+
+		// This must be the last thing that touches the group, as the waiter may return as soon as it
+		// sees it.
+		__atomic_fetch_add(&done_, 1, __ATOMIC_RELEASE);
+	}
+}
+
+void task_group::wait()
+{
+	thread_pool::worker *self = pool_.current_worker();
+	int idle = 0;
+
+	while (u32 pending = load(pending_)) {
+		// Rather than sitting idle, help with whatever work is queued up, which will often be the tasks
+		// in this group.
+		task *t = pool_.find_task(self);
+		if (t) {
+			pool_.execute(*t);
+			idle = 0;
+		} else if (++idle < spin_limit) {
+			__relax();
+		} else {
+			syscalls::futex_wait(&pending_, pending);
+			idle = 0;
+		}
+	}
+
+	// The last task has finished, but the worker that ran it may still be waking us up.
+	while (__atomic_load_n(&done_, __ATOMIC_ACQUIRE) != load(started_)) {
+		__relax();
+	}
+
+	release_tasks();
+}
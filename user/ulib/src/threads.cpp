@@ -12,13 +12,16 @@ using namespace stacsos;
 
 static void thread_entry_proc(thread_context *tc)
 {
+	// The thread-local pointers live in the thread context (the main thread's are set up in start_main).
+	syscalls::set_fs((u64)&tc->local_[0]);
+
 	tc->result_ = tc->ep_(tc->arg_);
 	syscalls::stop_current_thread();
 }
 
 thread *thread::start(thread_entry_fn ep, void *arg)
 {
-	auto tc = new thread_context { ep, arg, nullptr };
+	auto tc = new thread_context { ep, arg, nullptr, {} };
 
 	auto r = syscalls::start_thread((void *)thread_entry_proc, tc);
 	if (r.code != syscall_result_code::ok) {
@@ -33,3 +36,27 @@ void *thread::join()
 	auto r = syscalls::join_thread(handle_);
 	return tc_->result_;
 }
+
+bool thread::set_policy(sched_policy policy, u32 priority)
+{
+	return syscalls::set_thread_policy(handle_, policy, priority).code == syscall_result_code::ok;
+}
+
+bool thread::set_current_policy(sched_policy policy, u32 priority)
+{
+	return syscalls::set_thread_policy(0, policy, priority).code == syscall_result_code::ok;
+}
+
+syscall_result_code thread::set_deadline(u64 runtime_us, u64 deadline_us, u64 period_us)
+{
+	return syscalls::set_thread_deadline(handle_, runtime_us, deadline_us, period_us).code;
+}
+
+syscall_result_code thread::set_current_deadline(u64 runtime_us, u64 deadline_us, u64 period_us)
+{
+	return syscalls::set_thread_deadline(0, runtime_us, deadline_us, period_us).code;
+}
+
+bool thread::set_affinity(u64 core_mask) { return syscalls::set_thread_affinity(handle_, core_mask).code == syscall_result_code::ok; }
+
+bool thread::set_current_affinity(u64 core_mask) { return syscalls::set_thread_affinity(0, core_mask).code == syscall_result_code::ok; }